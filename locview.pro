@@ -4,7 +4,11 @@ CONFIG += c++14
 
 INCLUDEPATH += 3rdparty
 
+# PngStreamWriter compresses the image data with zlib directly
+LIBS += -lz
+
 SOURCES += \
+    src/benchmark.cpp \
     src/codeiteminfowidget.cpp \
     src/main.cpp \
     src/mainwindow.cpp \
@@ -12,24 +16,46 @@ SOURCES += \
     src/codemodelcache.cpp \
     src/codemodeldialog.cpp \
     src/codeutil.cpp \
+    src/codetreemapprovider.cpp \
+    src/framestats.cpp \
+    src/interactionsession.cpp \
+    src/synthetictreemapprovider.cpp \
+    src/glyphatlas.cpp \
+    src/textmetricscache.cpp \
+    src/treemapexporter.cpp \
     src/treemaplayouter.cpp \
+    src/treemaprasterizer.cpp \
     src/treemapwidget.cpp \
     src/progressbar.cpp \
     src/persistent.cpp \
+    src/pngstreamwriter.cpp \
     src/util.cpp \
     3rdparty/hsluv-c/src/hsluv.c
 
 HEADERS += \
+    src/benchmark.h \
     src/codeiteminfowidget.h \
     src/mainwindow.h \
     src/codemodel.h \
     src/codemodelcache.h \
     src/codemodeldialog.h \
     src/codeutil.h \
+    src/codetreemapprovider.h \
+    src/framestats.h \
+    src/interactionsession.h \
+    src/synthetictreemapprovider.h \
+    src/glyphatlas.h \
+    src/textmetricscache.h \
+    src/treemapbuffer.h \
+    src/treemapexporter.h \
     src/treemaplayouter.h \
+    src/treemapdataprovider.h \
+    src/treemapinstance.h \
+    src/treemaprasterizer.h \
     src/treemapwidget.h \
     src/progressbar.h \
     src/persistent.h \
+    src/pngstreamwriter.h \
     src/util.h \
     src/squarify.h \
     3rdparty/hsluv-c/src/hsluv.h
@@ -0,0 +1,195 @@
+#include "benchmark.h"
+
+#include "squarify.h"
+#include "synthetictreemapprovider.h"
+#include "treemaplayouter.h"
+
+#include <QElapsedTimer>
+#include <QFont>
+#include <QJsonArray>
+#include <QRandomGenerator>
+#include <QSize>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/** Number of children squarified per sample, so that small and large directories take a similar time */
+static constexpr int SQUARIFY_SAMPLE_CHILDREN = 200000;
+static constexpr int SQUARIFY_SAMPLES = 25;
+
+/** Size of the scene, which is large enough to lay out most of the tree, like an export */
+static constexpr int LAYOUT_BENCHMARK_SIZE = 16384;
+static constexpr int LAYOUT_BENCHMARK_RUNS = 5;
+
+/** Number of points per side of the grid on which hit-testing is checked against a linear scan */
+static constexpr int HIT_TEST_GRID = 32;
+
+static QJsonObject summarize(QVector<double> samples)
+{
+    std::sort(samples.begin(), samples.end());
+
+    QJsonObject ret;
+    ret["samples"] = (int) samples.size();
+    if (!samples.isEmpty()) {
+        ret["min"] = samples.first();
+        ret["median"] = samples[samples.size() / 2];
+        ret["max"] = samples.last();
+    }
+    return ret;
+}
+
+static double median(const QVector<double> &samples)
+{
+    return summarize(samples)["median"].toDouble();
+}
+
+/** A layouter without any output, which only lays out the tree */
+class BenchmarkLayouter : public TreeMapLayouter
+{
+public:
+    BenchmarkLayouter(int width, int height) : TreeMapLayouter(width, height), m_viewSize(width, height) {}
+
+    using TreeMapLayouter::setLayoutThreadCount;
+    using TreeMapLayouter::layoutNsecs;
+
+    /**
+     * Hit-tests a grid of points, and compares the results to a linear scan
+     * over all rendered nodes, which are checked the same way as getNodeAt()
+     * does: group labels within their node cover its children, and the
+     * shallowest hit wins. Returns the number of points where both disagree.
+     */
+    int hitTestMismatches(int gridSize)
+    {
+        QVector<const Node*> candidates;
+        traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
+            if (node.renderState == Render || (node.renderState == RenderChildren && !node.groupLabelRect.isNull()))
+                candidates << &node;
+            return node.renderState == RenderChildren;
+        });
+
+        int mismatches = 0;
+        for (int i = 0; i < gridSize; ++i) {
+            for (int j = 0; j < gridSize; ++j) {
+                const QPoint pt((2 * i + 1) * m_viewSize.width() / (2 * gridSize), (2 * j + 1) * m_viewSize.height() / (2 * gridSize));
+
+                const Node *expected = nullptr;
+                QVector<const Node*> hits;
+                for (const Node *node : candidates) {
+                    if (!node->viewRect.contains(pt))
+                        continue;
+                    if (node->renderState != Render && !node->groupLabelRect.contains(pt))
+                        continue;
+                    hits << node;
+                    if (!expected || node->depth < expected->depth)
+                        expected = node;
+                }
+
+                // points on the shared edge of two nodes may go either way
+                const Node *hit = getNodeAt(pt, m_renderedNode);
+                const bool tie = hit && expected && hit->depth == expected->depth && hits.contains(hit);
+                if (hit != expected && !tie)
+                    ++mismatches;
+            }
+        }
+        return mismatches;
+    }
+
+protected:
+    void onNodeTreeChanged() override {}
+    void onLayoutChanged() override {}
+    void onViewportChanged() override {}
+
+private:
+    QSize m_viewSize;
+};
+
+QJsonObject benchmarkSquarify()
+{
+    QJsonArray results;
+    for (const int children : {10, 1000, 100000}) {
+        // same long-tailed distribution as the files of SyntheticTreeMapProvider
+        QRandomGenerator rng(1);
+        std::vector<float> sizes(children);
+        for (float &size : sizes)
+            size = qRound(std::exp(rng.generateDouble() * 8.0));
+
+        // the buffers are re-used like the layouter's, so only the warm-up run allocates
+        Squarify::Squarify squarify;
+        std::vector<Squarify::Row> rows;
+        std::vector<Squarify::Element> elements;
+        const Squarify::Rect rect(0.0f, 0.0f, 1920.0f, 1080.0f);
+        squarify.compute(sizes, rect, rows, elements);
+
+        const int runs = qMax(1, SQUARIFY_SAMPLE_CHILDREN / children);
+        QVector<double> samples;
+        QElapsedTimer timer;
+        for (int i = 0; i < SQUARIFY_SAMPLES; ++i) {
+            timer.start();
+            for (int j = 0; j < runs; ++j)
+                squarify.compute(sizes, rect, rows, elements);
+            samples << timer.nsecsElapsed() / 1e3 / runs;
+        }
+
+        QJsonObject result;
+        result["children"] = children;
+        result["rows"] = (int) rows.size();
+        result["runs_per_sample"] = runs;
+        result["layout_us"] = summarize(samples);
+        results << result;
+    }
+
+    QJsonObject report;
+    report["squarify"] = results;
+    return report;
+}
+
+QJsonObject benchmarkLayout(int nodeCount)
+{
+    const QSharedPointer<const TreeMapDataProvider> provider(new SyntheticTreeMapProvider(nodeCount));
+    BenchmarkLayouter layouter(LAYOUT_BENCHMARK_SIZE, LAYOUT_BENCHMARK_SIZE);
+
+    QVector<int> threadCounts;
+    const int cores = QThread::idealThreadCount();
+    for (int threads = 1; threads < cores; threads *= 2)
+        threadCounts << threads;
+    threadCounts << qMax(1, cores);
+
+    QJsonArray results;
+    double singleThreadMsecs = 0.0;
+    for (const int threads : threadCounts) {
+        layouter.setLayoutThreadCount(threads);
+
+        QVector<double> samples;
+        for (int i = 0; i < LAYOUT_BENCHMARK_RUNS; ++i) {
+            // the layouter takes over the nodes of the tree, so every run needs a
+            // new one. only the batches of nodes laid out are timed, without culling.
+            const QSharedPointer<TreeMapLayouter::NodeTree> tree = TreeMapLayouter::buildNodeTree(provider, QFont());
+            layouter.setNodeTree(tree);
+            samples << layouter.layoutNsecs() / 1e6;
+        }
+
+        const double msecs = median(samples);
+        if (threads == 1)
+            singleThreadMsecs = msecs;
+
+        QJsonObject result;
+        result["threads"] = threads;
+        result["layout_ms"] = summarize(samples);
+        result["speedup"] = msecs > 0.0 ? singleThreadMsecs / msecs : 0.0;
+        results << result;
+    }
+
+    QJsonObject report;
+    report["nodes"] = provider->nodeCount();
+    report["scene_size"] = LAYOUT_BENCHMARK_SIZE;
+    report["cores"] = cores;
+    report["layout"] = results;
+
+    QJsonObject hitTest;
+    hitTest["points"] = HIT_TEST_GRID * HIT_TEST_GRID;
+    hitTest["mismatches"] = layouter.hitTestMismatches(HIT_TEST_GRID);
+    report["hit_test"] = hitTest;
+    return report;
+}
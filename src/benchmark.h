@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QJsonObject>
+
+// micro-benchmarks of the layout, which run from the command line without any
+// windows, and report their timings as JSON
+
+/** Times Squarify::compute() for single directories of 10, 1k and 100k children */
+QJsonObject benchmarkSquarify();
+
+/**
+ * Times the layout of a deep and wide synthetic tree of the given size from
+ * the root, with 1, 2, 4... up to one layout thread per core. Also reports
+ * the points where hit-testing disagrees with a linear scan, under "hit_test".
+ */
+QJsonObject benchmarkLayout(int nodeCount);
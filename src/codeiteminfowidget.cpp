@@ -88,7 +88,7 @@ void CodeItemInfoWidget::update()
                      .arg(formatNumDecimals(files));
 
         const FileEndingStats::DirStats dirStats = FileEndingStats::getDirStats({dir}, m_excludes);
-        for (const FileEndingStats::Entry &entry : dirStats.total) {
+        for (const FileEndingStats::Entry &entry : FileEndingStats::sorted(dirStats.total)) {
             text += QString::asprintf("\n*.%1 (%2 loc, %3 files)")
                     .arg(entry.ending)
                     .arg(formatNumDecimals(entry.loc))
@@ -1,4 +1,5 @@
 #include "codemodel.h"
+#include "codeutil.h"
 #include "persistent.h"
 
 #include <QDir>
@@ -152,6 +153,7 @@ File::File(Directory *dir, const QString &name, const QString &ending, qint64 sz
     : m_dir(dir)
     , m_name(name)
     , m_ending(ending)
+    , m_endingId(FileEndingStats::endingId(ending))
     , m_size(sz)
     , m_lastModified(lastModified)
 {
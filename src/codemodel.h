@@ -83,6 +83,7 @@ public:
     QString name() const override { return m_name; }
     QString fullName() const override;
     QString ending() const { return m_ending; }
+    int endingId() const { return m_endingId; }
     qint64 size() const { return m_size; }
     QDateTime lastModified() const { return m_lastModified; }
 
@@ -104,6 +105,7 @@ private:
     Directory *m_dir = nullptr;
     QString m_name;
     QString m_ending;
+    int m_endingId = -1;
     bool m_ok = false;
     qint64 m_size;
     QDateTime m_lastModified;
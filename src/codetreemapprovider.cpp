@@ -0,0 +1,119 @@
+#include "codetreemapprovider.h"
+
+CodeTreeMapProvider::CodeTreeMapProvider(const QVector<const Directory*> &rootDirs,
+                                         const QStringList &excludeList,
+                                         const QVector<QColor> &palette)
+{
+    // if there is only one root node, we can remove its prefix from all
+    // groupLabels along the way
+    if (rootDirs.size() == 1)
+        m_removePrefix = rootDirs.first()->fullName();
+
+    Item root;
+    root.name = "root";
+    root.fullName = "root";
+    m_items << root;
+
+    QVector<const Directory*> includedRootDirs;
+    for (const Directory *dir : rootDirs) {
+        if (!excludeList.contains(dir->path()))
+            includedRootDirs << dir;
+    }
+
+    reserveChildren(0, includedRootDirs.size());
+    for (int i = 0; i < includedRootDirs.size(); ++i) {
+        const int childId = addDir(includedRootDirs[i], excludeList, palette);
+        m_childIds[m_items[0].firstChild + i] = childId;
+        m_items[0].size += m_items[childId].size;
+    }
+    updateColor(0);
+}
+
+CodeTreeMapProvider::~CodeTreeMapProvider()
+{
+}
+
+QString CodeTreeMapProvider::label(int node) const
+{
+    const Item &item = m_items[node];
+    return item.isFile ? (item.name + "." + item.ending) : item.name;
+}
+
+QString CodeTreeMapProvider::groupLabel(int node) const
+{
+    const Item &item = m_items[node];
+    if (item.isFile)
+        return label(node);
+    if (!m_removePrefix.isEmpty() && item.fullName.startsWith(m_removePrefix))
+        return item.fullName.mid(m_removePrefix.size());
+    return item.fullName;
+}
+
+int CodeTreeMapProvider::addFile(const File *file, const QVector<QColor> &palette)
+{
+    Item item;
+    item.userData = (void*) file;
+    item.name = file->name();
+    item.ending = file->ending();
+    item.isFile = true;
+    item.size = file->loc();
+    item.color = palette.value(file->endingId()).rgb();
+
+    m_items << item;
+    return m_items.size() - 1;
+}
+
+int CodeTreeMapProvider::addDir(const Directory *dir, const QStringList &excludeList, const QVector<QColor> &palette)
+{
+    Item item;
+    item.userData = (void*) dir;
+    item.name = dir->name();
+    item.fullName = dir->fullName();
+
+    const int id = m_items.size();
+    m_items << item;
+
+    QVector<const CodeItem*> children;
+    children.reserve(dir->children().size());
+    for (const CodeItem *child : dir->children()) {
+        if (!excludeList.contains(child->path()))
+            children << child;
+    }
+
+    // ids are handed out in depth-first order, so reserve this node's child
+    // slots before descending into the children
+    reserveChildren(id, children.size());
+    for (int i = 0; i < children.size(); ++i) {
+        const int childId = (children[i]->type() == CodeItem::Type_File)
+                ? addFile((const File*) children[i], palette)
+                : addDir((const Directory*) children[i], excludeList, palette);
+        m_childIds[m_items[id].firstChild + i] = childId;
+        m_items[id].size += m_items[childId].size;
+    }
+    updateColor(id);
+
+    return id;
+}
+
+void CodeTreeMapProvider::reserveChildren(int id, int count)
+{
+    m_items[id].firstChild = m_childIds.size();
+    m_items[id].childCount = count;
+    m_childIds.resize(m_childIds.size() + count);
+}
+
+void CodeTreeMapProvider::updateColor(int id)
+{
+    Item &item = m_items[id];
+    if (item.size <= 0.0f)
+        return;
+
+    float r = 0.0f, g = 0.0f, b = 0.0f;
+    for (int i = 0; i < item.childCount; ++i) {
+        const Item &child = m_items[m_childIds[item.firstChild + i]];
+        r += qRed(child.color) * child.size;
+        g += qGreen(child.color) * child.size;
+        b += qBlue(child.color) * child.size;
+    }
+    item.color = qRgb(r / item.size, g / item.size, b / item.size);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <QVector>
+#include <QStringList>
+#include <QColor>
+
+#include "treemapdataprovider.h"
+#include "codemodel.h"
+
+/**
+ * Exposes the Directories and Files of a CodeModel to the TreeMapLayouter.
+ *
+ * The tree is flattened into arrays once on construction. Labels are not
+ * stored, but assembled on request from the (implicitly shared) names of
+ * the code items.
+ */
+class CodeTreeMapProvider : public TreeMapDataProvider
+{
+public:
+    CodeTreeMapProvider(const QVector<const Directory*> &rootDirs,
+                        const QStringList &excludeList,
+                        const QVector<QColor> &palette);
+    ~CodeTreeMapProvider();
+
+    int nodeCount() const override { return m_items.size(); }
+    int childCount(int node) const override { return m_items[node].childCount; }
+    int child(int node, int index) const override { return m_childIds[m_items[node].firstChild + index]; }
+
+    float size(int node) const override { return m_items[node].size; }
+    QColor color(int node) const override { return QColor::fromRgb(m_items[node].color); }
+    QString label(int node) const override;
+    QString groupLabel(int node) const override;
+    void *userData(int node) const override { return m_items[node].userData; }
+
+private:
+    struct Item
+    {
+        void *userData = nullptr;
+        QString name;
+        QString ending;     // only set for files
+        QString fullName;   // only set for directories
+        bool isFile = false;
+        float size = 0.0f;
+        QRgb color = 0;
+        int firstChild = 0; // offset into m_childIds
+        int childCount = 0;
+    };
+
+    int addFile(const File *file, const QVector<QColor> &palette);
+    int addDir(const Directory *dir, const QStringList &excludeList, const QVector<QColor> &palette);
+    void reserveChildren(int id, int count);
+    void updateColor(int id);
+
+    QVector<Item> m_items;
+    QVector<int> m_childIds;
+    QString m_removePrefix;
+};
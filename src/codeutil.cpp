@@ -1,63 +1,133 @@
 #include "codeutil.h"
 
+#include <QMutex>
+#include <QMutexLocker>
+
 namespace FileEndingStats {
 
-static Entry &getEntry(Stats &stats, const QString &ending)
+struct EndingRegistry
 {
-    for (Entry &entry : stats) {
-        if (entry.ending == ending)
-            return entry;
-    }
-    stats << Entry{ending, 0, 0};
-    return stats.last();
+    QMutex mutex;
+    QHash<QString, int> ids;
+    QVector<QString> names;
+};
+
+static EndingRegistry &registry()
+{
+    static EndingRegistry s_registry;
+    return s_registry;
+}
+
+int endingId(const QString &ending)
+{
+    EndingRegistry &reg = registry();
+    QMutexLocker lock(&reg.mutex);
+
+    const auto it = reg.ids.constFind(ending);
+    if (it != reg.ids.constEnd())
+        return it.value();
+
+    const int id = reg.names.size();
+    reg.ids.insert(ending, id);
+    reg.names << ending;
+    return id;
+}
+
+QString endingName(int id)
+{
+    EndingRegistry &reg = registry();
+    QMutexLocker lock(&reg.mutex);
+    return reg.names.value(id);
+}
+
+int endingCount()
+{
+    EndingRegistry &reg = registry();
+    QMutexLocker lock(&reg.mutex);
+    return reg.names.size();
 }
 
-void mergeStats(Stats &dst, const Stats &other)
+void Histogram::resize(int width)
 {
-    for (auto it = other.begin(); it != other.end(); ++it) {
-        Entry &entry = getEntry(dst, it->ending);
-        entry.loc += it->loc;
-        entry.fileCount += it->fileCount;
+    fileCount.resize(width);
+    loc.resize(width);
+}
+
+void Histogram::add(const Histogram &other)
+{
+    if (other.loc.size() > loc.size())
+        resize(other.loc.size());
+
+    // plain loops over contiguous arrays, so that the compiler can turn them into vector adds
+    const int n = other.loc.size();
+    int *dstFiles = fileCount.data();
+    int *dstLoc = loc.data();
+    const int *srcFiles = other.fileCount.constData();
+    const int *srcLoc = other.loc.constData();
+    for (int i = 0; i < n; ++i)
+        dstFiles[i] += srcFiles[i];
+    for (int i = 0; i < n; ++i)
+        dstLoc[i] += srcLoc[i];
+}
+
+Stats sorted(const Histogram &histogram)
+{
+    Stats ret;
+    for (int id = 0; id < histogram.loc.size(); ++id) {
+        if (histogram.fileCount[id] > 0)
+            ret << Entry{id, endingName(id), histogram.fileCount[id], histogram.loc[id]};
     }
+
+    std::sort(ret.begin(), ret.end(), [](const Entry &a, const Entry &b) {
+        return a.loc > b.loc;
+    });
+
+    return ret;
 }
 
 DirStats getDirStats(const QVector<const Directory*> dirs, const QStringList &excludeList)
 {
     DirStats ret;
 
+    const int width = endingCount();
+    const bool hasExcludes = !excludeList.isEmpty();
+    ret.total.resize(width);
+
     for (const Directory *rootDir : dirs) {
-        if (excludeList.contains(rootDir->path()))
+        if (hasExcludes && excludeList.contains(rootDir->path()))
             continue;
 
         rootDir->traverse([&](const Directory *dir) {
-            Stats &endings = ret.perDir[dir];
+            Histogram endings;
+            endings.resize(width);
 
             for (const CodeItem *child : dir->children()) {
-                if (excludeList.contains(child->path()))
+                if (hasExcludes && excludeList.contains(child->path()))
                     continue;
 
                 if (child->type() == CodeItem::Type_File) {
-                    File *file = (File*) child;
-                    Entry &entry = getEntry(endings, file->ending());
-                    entry.loc += file->loc();
-                    entry.fileCount += 1;
+                    const File *file = (const File*) child;
+                    const int id = file->endingId();
+                    if (id >= endings.loc.size())
+                        endings.resize(id + 1);
+                    endings.loc[id] += file->loc();
+                    endings.fileCount[id] += 1;
                 }
 
                 if (child->type() == CodeItem::Type_Directory) {
-                    Q_ASSERT(ret.perDir.contains((Directory*) child));
-                    mergeStats(endings, ret.perDir[(Directory*) child]);
+                    const auto it = ret.perDir.constFind((const Directory*) child);
+                    Q_ASSERT(it != ret.perDir.constEnd());
+                    endings.add(it.value());
                 }
             }
 
-            std::sort(endings.begin(), endings.end(), [](const Entry &a, const Entry &b) {
-                return a.loc > b.loc;
-            });
+            ret.perDir.insert(dir, endings);
         }, CodeItem::ChildrenFirst);
 
-        mergeStats(ret.total, ret.perDir[rootDir]);
+        ret.total.add(ret.perDir[rootDir]);
     }
 
     return ret;
 }
 
-} // namespace Stats
+} // namespace FileEndingStats
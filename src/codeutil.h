@@ -6,20 +6,42 @@
 
 namespace FileEndingStats {
 
+    /**
+     * File endings are mapped to small, dense integer ids while the code model
+     * is being scanned. Ids stay valid for the lifetime of the process, so they
+     * can be used to index Histogram arrays and palettes.
+     */
+    int endingId(const QString &ending);
+    QString endingName(int id);
+    int endingCount();
+
     struct Entry
     {
+        int id = -1;
         QString ending;
         int fileCount = 0;
         int loc = 0;
     };
 
     using Stats = QVector<Entry>;
-    void mergeStats(Stats &dst, const Stats &other);
+
+    /** Fixed-width file/loc counters, indexed by ending id */
+    struct Histogram
+    {
+        QVector<int> fileCount;
+        QVector<int> loc;
+
+        void resize(int width);
+        void add(const Histogram &other);
+    };
+
+    /** Returns the non-empty entries of a histogram, sorted by descending loc */
+    Stats sorted(const Histogram &histogram);
 
     struct DirStats
     {
-        QHash<const Directory*, Stats> perDir;
-        Stats total;
+        QHash<const Directory*, Histogram> perDir;
+        Histogram total;
     };
 
     DirStats getDirStats(const QVector<const Directory*> dirs, const QStringList &excludeList);
@@ -0,0 +1,110 @@
+#include "framestats.h"
+
+#include <algorithm>
+#include <cmath>
+
+FrameStats::FrameStats(int windowSize)
+    : m_windowSize(qMax(1, windowSize))
+{
+}
+
+void FrameStats::add(Metric metric, double value)
+{
+    // the window is a ring buffer, once it has been filled up
+    Samples &samples = m_samples[metric];
+    if (samples.values.size() < m_windowSize) {
+        samples.values << value;
+    } else {
+        samples.values[samples.next] = value;
+        samples.next = (samples.next + 1) % m_windowSize;
+    }
+}
+
+void FrameStats::clear()
+{
+    for (Samples &samples : m_samples) {
+        samples.values.clear();
+        samples.next = 0;
+    }
+}
+
+double FrameStats::percentile(QVector<double> values, double p)
+{
+    if (values.isEmpty())
+        return 0.0;
+
+    const int rank = qBound(1, (int) std::ceil(p * values.size()), (int) values.size());
+    std::nth_element(values.begin(), values.begin() + rank - 1, values.end());
+    return values[rank - 1];
+}
+
+QJsonObject FrameStats::summarize(const QVector<double> &values)
+{
+    QJsonObject ret;
+    ret["samples"] = (int) values.size();
+    ret["p50"] = percentile(values, 0.5);
+    ret["p95"] = percentile(values, 0.95);
+    ret["p99"] = percentile(values, 0.99);
+    ret["max"] = percentile(values, 1.0);
+    return ret;
+}
+
+QString FrameStats::name(Metric metric)
+{
+    switch (metric) {
+    case FrameTime: return "frame_ms";
+    case CullTime: return "cull_ms";
+    case InstanceTime: return "instances_ms";
+    case GroupTime: return "groups_ms";
+    case RasterizeTime: return "rasterize_ms";
+    case UploadTime: return "upload_ms";
+    case SceneTime: return "scene_ms";
+    case GpuTime: return "gpu_ms";
+    case OverlayTime: return "overlay_ms";
+    case UploadedBytes: return "uploaded_bytes";
+    case AllocatedBytes: return "allocated_bytes";
+    case CulledViewportNodes: return "culled_viewport_nodes";
+    case CulledDepthNodes: return "culled_depth_nodes";
+    case RenderNodes: return "render_nodes";
+    case RenderChildrenNodes: return "render_children_nodes";
+    case TextMeasures: return "text_measures";
+    case HitTestNodes: return "hit_test_nodes";
+    case MetricCount: break;
+    }
+    return QString();
+}
+
+QStringList FrameStats::summary() const
+{
+    QStringList lines;
+    lines << QString("%1 %2 %3 %4").arg(QString(), -22).arg("p50", 10).arg("p95", 10).arg("p99", 10);
+    for (int i = 0; i < MetricCount; ++i) {
+        const Metric metric = (Metric) i;
+        if (sampleCount(metric) == 0)
+            continue;
+
+        const int precision = isTime(metric) ? 2 : 0;
+        QString line = QString("%1").arg(name(metric), -22);
+        for (const double p : {0.5, 0.95, 0.99})
+            line += QString(" %1").arg(percentile(metric, p), 10, 'f', precision);
+        lines << line;
+    }
+    return lines;
+}
+
+QJsonObject FrameStats::toJson() const
+{
+    QJsonObject metrics;
+    for (int i = 0; i < MetricCount; ++i) {
+        const Metric metric = (Metric) i;
+        if (sampleCount(metric) == 0)
+            continue;
+
+        metrics[name(metric)] = summarize(m_samples[metric].values);
+    }
+
+    QJsonObject ret;
+    ret["window"] = m_windowSize;
+    ret["metrics"] = metrics;
+    return ret;
+}
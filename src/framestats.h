@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Rolling statistics of per-frame timings and counters, reported as the
+ * 50th, 95th and 99th percentile of their last samples.
+ *
+ * Every metric keeps its own window of samples, as not every frame measures
+ * everything: the layout and build phases only show up in frames that picked
+ * up a new render list, and GPU timings arrive a frame late, if at all.
+ */
+class FrameStats
+{
+public:
+    enum Metric
+    {
+        FrameTime,          // paintGL(), in ms
+        CullTime,           // applying the viewport, incl. layout of newly visible nodes
+        InstanceTime,       // building node and label instances
+        GroupTime,          // building group outlines and labels
+        RasterizeTime,      // software rendering only
+        UploadTime,         // streaming a new render list to GL
+        SceneTime,          // issuing the draw calls of the scene
+        GpuTime,            // GPU time of the scene, if timer queries are supported
+        OverlayTime,        // QPainter outlines and this overlay
+        UploadedBytes,
+        AllocatedBytes,
+        CulledViewportNodes,
+        CulledDepthNodes,
+        RenderNodes,
+        RenderChildrenNodes,
+        TextMeasures,
+        HitTestNodes,
+        MetricCount
+    };
+
+    FrameStats(int windowSize = 240);
+
+    void add(Metric metric, double value);
+    void clear();
+
+    int windowSize() const { return m_windowSize; }
+    int sampleCount(Metric metric) const { return m_samples[metric].values.size(); }
+
+    /** Nearest-rank percentile of the metric's current window, p in [0, 1] */
+    double percentile(Metric metric, double p) const { return percentile(m_samples[metric].values, p); }
+    static double percentile(QVector<double> values, double p);
+
+    /** Sample count, percentiles and maximum of the given values */
+    static QJsonObject summarize(const QVector<double> &values);
+
+    static QString name(Metric metric);
+    static bool isTime(Metric metric) { return metric <= OverlayTime; }
+
+    /** One line per metric with samples, for the on-screen overlay */
+    QStringList summary() const;
+
+    /** Percentiles and sample counts of all metrics, keyed by name() */
+    QJsonObject toJson() const;
+
+private:
+    struct Samples
+    {
+        QVector<double> values;
+        int next = 0;
+    };
+    int m_windowSize;
+    Samples m_samples[MetricCount];
+};
@@ -0,0 +1,97 @@
+#include "glyphatlas.h"
+
+#include <QPainter>
+#include <QtMath>
+
+static constexpr int ATLAS_WIDTH = 512;
+static constexpr int ATLAS_MAX_HEIGHT = 4096;
+
+GlyphAtlas::GlyphAtlas(const QFont &font)
+    : m_font(font)
+    , m_metrics(font)
+{
+    clear();
+}
+
+void GlyphAtlas::setFont(const QFont &font)
+{
+    if (m_font == font)
+        return;
+
+    m_font = font;
+    m_metrics = QFontMetricsF(font);
+    clear();
+}
+
+void GlyphAtlas::clear()
+{
+    m_glyphs.clear();
+    m_rowHeight = qCeil(m_metrics.height());
+    m_image = QImage(ATLAS_WIDTH, qMax(64, 4 * m_rowHeight), QImage::Format_ARGB32_Premultiplied);
+    m_image.fill(Qt::transparent);
+    m_cursor = QPoint(0, 0);
+    m_dirty = true;
+}
+
+const GlyphAtlas::Glyph &GlyphAtlas::glyph(char32_t codePoint)
+{
+    auto it = m_glyphs.find(codePoint);
+    if (it == m_glyphs.end())
+        it = m_glyphs.insert(codePoint, rasterize(codePoint));
+    return it.value();
+}
+
+float GlyphAtlas::textWidth(const QString &text)
+{
+    float width = 0.0f;
+    forEachCodePoint(text, [&](char32_t codePoint) {
+        width += glyph(codePoint).advance;
+    });
+    return width;
+}
+
+bool GlyphAtlas::takeDirty()
+{
+    const bool ret = m_dirty;
+    m_dirty = false;
+    return ret;
+}
+
+GlyphAtlas::Glyph GlyphAtlas::rasterize(char32_t codePoint)
+{
+    const QString text = QString::fromUcs4(&codePoint, 1);
+    Glyph glyph;
+    glyph.advance = m_metrics.horizontalAdvance(text);
+    if (QChar::isSpace(codePoint))
+        return glyph;
+
+    // leave a pixel of space between glyphs, so that they don't bleed into each other
+    const QSize size(qMin(qCeil(glyph.advance) + 1, ATLAS_WIDTH), m_rowHeight);
+    if (m_cursor.x() + size.width() > ATLAS_WIDTH)
+        m_cursor = QPoint(0, m_cursor.y() + m_rowHeight + 1);
+
+    if (m_cursor.y() + size.height() > m_image.height()) {
+        if (2 * m_image.height() > ATLAS_MAX_HEIGHT) {
+            qWarning("Glyph atlas is full");
+            return glyph;
+        }
+        QImage grown(m_image.width(), 2 * m_image.height(), m_image.format());
+        grown.fill(Qt::transparent);
+        QPainter painter(&grown);
+        painter.drawImage(0, 0, m_image);
+        painter.end();
+        m_image = grown;
+    }
+
+    QPainter painter(&m_image);
+    painter.setFont(m_font);
+    painter.setPen(Qt::white);
+    painter.drawText(QPointF(m_cursor.x(), m_cursor.y() + m_metrics.ascent()), text);
+    painter.end();
+
+    glyph.atlasPos = m_cursor;
+    glyph.size = size;
+    m_cursor.rx() += size.width() + 1;
+    m_dirty = true;
+    return glyph;
+}
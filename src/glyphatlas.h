@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QFont>
+#include <QFontMetricsF>
+#include <QHash>
+#include <QImage>
+#include <QPoint>
+#include <QSize>
+#include <QString>
+
+/**
+ * Rasterizes the glyphs of one font into a single image on demand, so that
+ * text can be drawn as textured quads instead of through QPainter.
+ *
+ * Glyphs are packed into rows of equal height, and the image doubles its
+ * height whenever it runs full. Like TextMetricsCache, text is laid out by
+ * summing up per-glyph advances, ignoring kerning.
+ */
+class GlyphAtlas
+{
+public:
+    struct Glyph
+    {
+        QPoint atlasPos;
+        QSize size;
+        float advance = 0.0f;
+    };
+
+    GlyphAtlas(const QFont &font = QFont());
+
+    QFont font() const { return m_font; }
+    void setFont(const QFont &font);
+
+    /** Glyphs are looked up by code point, so characters outside the BMP aren't split into surrogates */
+    const Glyph &glyph(char32_t codePoint);
+    float textWidth(const QString &text);
+
+    /** Calls the visitor with every code point of the text */
+    template <class Visitor>
+    static void forEachCodePoint(const QString &text, Visitor visitor)
+    {
+        for (int i = 0; i < text.size(); ++i) {
+            const QChar c = text[i];
+            if (c.isHighSurrogate() && i + 1 < text.size() && text[i + 1].isLowSurrogate())
+                visitor(QChar::surrogateToUcs4(c, text[++i]));
+            else
+                visitor(char32_t(c.unicode()));
+        }
+    }
+
+    int lineHeight() const { return m_rowHeight; }
+
+    /** White glyphs on a transparent background */
+    const QImage &image() const { return m_image; }
+
+    /** Returns whether glyphs were added to the image since the last call */
+    bool takeDirty();
+
+private:
+    void clear();
+    Glyph rasterize(char32_t codePoint);
+
+    QFont m_font;
+    QFontMetricsF m_metrics;
+    QImage m_image;
+    QHash<char32_t, Glyph> m_glyphs;
+    QPoint m_cursor;
+    int m_rowHeight = 0;
+    bool m_dirty = true;
+};
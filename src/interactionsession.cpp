@@ -0,0 +1,280 @@
+#include "interactionsession.h"
+#include "treemapwidget.h"
+#include "framestats.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QResizeEvent>
+#include <QSaveFile>
+#include <QWheelEvent>
+
+/** Frame statistics keep this many samples while replaying, i.e. all of them */
+static constexpr int REPLAY_STATS_WINDOW = 1000000;
+
+static const char *s_typeNames[] = {"press", "release", "double_click", "move", "wheel", "key", "resize"};
+
+QString InteractionSession::typeName(Event::Type type)
+{
+    return s_typeNames[type];
+}
+
+bool InteractionSession::save(const QString &fileName) const
+{
+    QJsonArray jsonEvents;
+    for (const Event &event : events) {
+        QJsonObject json;
+        json["type"] = typeName(event.type);
+        json["t"] = event.msecs;
+        json["x"] = event.pos.x();
+        json["y"] = event.pos.y();
+        if (event.button)
+            json["button"] = event.button;
+        if (event.buttons)
+            json["buttons"] = event.buttons;
+        if (event.modifiers)
+            json["modifiers"] = event.modifiers;
+        if (event.key)
+            json["key"] = event.key;
+        if (!event.angleDelta.isNull()) {
+            json["dx"] = event.angleDelta.x();
+            json["dy"] = event.angleDelta.y();
+        }
+        if (event.size.isValid()) {
+            json["width"] = event.size.width();
+            json["height"] = event.size.height();
+        }
+        jsonEvents << json;
+    }
+
+    QJsonObject json;
+    json["version"] = 1;
+    json["width"] = initialSize.width();
+    json["height"] = initialSize.height();
+    json["events"] = jsonEvents;
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(QJsonDocument(json).toJson(QJsonDocument::Compact));
+    return file.commit();
+}
+
+bool InteractionSession::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    const QJsonDocument doc = QJsonDocument::fromJson(file.readAll());
+    if (!doc.isObject())
+        return false;
+
+    const QJsonObject json = doc.object();
+    initialSize = QSize(json["width"].toInt(), json["height"].toInt());
+    events.clear();
+
+    QHash<QString, Event::Type> types;
+    for (int i = 0; i <= Event::Resize; ++i)
+        types[s_typeNames[i]] = (Event::Type) i;
+
+    for (const QJsonValue &value : json["events"].toArray()) {
+        const QJsonObject jsonEvent = value.toObject();
+        const QString type = jsonEvent["type"].toString();
+        if (!types.contains(type))
+            return false;
+
+        Event event;
+        event.type = types[type];
+        event.msecs = jsonEvent["t"].toInteger();
+        event.pos = QPointF(jsonEvent["x"].toDouble(), jsonEvent["y"].toDouble());
+        event.button = jsonEvent["button"].toInt();
+        event.buttons = jsonEvent["buttons"].toInt();
+        event.modifiers = jsonEvent["modifiers"].toInt();
+        event.key = jsonEvent["key"].toInt();
+        event.angleDelta = QPoint(jsonEvent["dx"].toInt(), jsonEvent["dy"].toInt());
+        if (jsonEvent.contains("width"))
+            event.size = QSize(jsonEvent["width"].toInt(), jsonEvent["height"].toInt());
+        events << event;
+    }
+
+    return true;
+}
+
+InteractionRecorder::InteractionRecorder(TreeMapWidget *widget)
+    : m_widget(widget)
+{
+    m_session.initialSize = widget->size();
+    m_timer.start();
+    widget->installEventFilter(this);
+}
+
+InteractionRecorder::~InteractionRecorder()
+{
+    if (m_widget)
+        m_widget->removeEventFilter(this);
+}
+
+bool InteractionRecorder::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched != m_widget)
+        return false;
+
+    using Event = InteractionSession::Event;
+    Event recorded;
+    recorded.msecs = m_timer.elapsed();
+
+    switch (event->type()) {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonRelease:
+    case QEvent::MouseButtonDblClick:
+    case QEvent::MouseMove: {
+        const QMouseEvent *mouseEvent = static_cast<const QMouseEvent*>(event);
+        if (event->type() == QEvent::MouseButtonPress)
+            recorded.type = Event::MousePress;
+        else if (event->type() == QEvent::MouseButtonRelease)
+            recorded.type = Event::MouseRelease;
+        else if (event->type() == QEvent::MouseButtonDblClick)
+            recorded.type = Event::MouseDoubleClick;
+        else
+            recorded.type = Event::MouseMove;
+        recorded.pos = mouseEvent->position();
+        recorded.button = mouseEvent->button();
+        recorded.buttons = mouseEvent->buttons().toInt();
+        recorded.modifiers = mouseEvent->modifiers().toInt();
+        break;
+    }
+    case QEvent::Wheel: {
+        const QWheelEvent *wheelEvent = static_cast<const QWheelEvent*>(event);
+        recorded.type = Event::Wheel;
+        recorded.pos = wheelEvent->position();
+        recorded.buttons = wheelEvent->buttons().toInt();
+        recorded.modifiers = wheelEvent->modifiers().toInt();
+        recorded.angleDelta = wheelEvent->angleDelta();
+        break;
+    }
+    case QEvent::KeyPress: {
+        const QKeyEvent *keyEvent = static_cast<const QKeyEvent*>(event);
+        recorded.type = Event::KeyPress;
+        recorded.key = keyEvent->key();
+        recorded.modifiers = keyEvent->modifiers().toInt();
+        break;
+    }
+    case QEvent::Resize:
+        recorded.type = Event::Resize;
+        recorded.size = static_cast<const QResizeEvent*>(event)->size();
+        break;
+    default:
+        return false;
+    }
+
+    m_session.events << recorded;
+    return false;
+}
+
+InteractionReplay::InteractionReplay(TreeMapWidget *widget)
+    : m_widget(widget)
+{
+}
+
+QJsonObject InteractionReplay::run(const InteractionSession &session)
+{
+    if (!session.initialSize.isEmpty())
+        m_widget->resize(session.initialSize);
+    m_widget->show();
+    waitForFrames();
+    m_widget->resetFrameStats(REPLAY_STATS_WINDOW);
+
+    QVector<double> latencies;
+    QHash<int, QVector<double>> typeLatencies;
+    QJsonArray jsonEvents;
+
+    QElapsedTimer timer;
+    for (const InteractionSession::Event &event : session.events) {
+        timer.start();
+        send(event);
+        waitForFrames();
+        const double msecs = timer.nsecsElapsed() / 1e6;
+
+        latencies << msecs;
+        typeLatencies[event.type] << msecs;
+
+        QJsonObject jsonEvent;
+        jsonEvent["type"] = InteractionSession::typeName(event.type);
+        jsonEvent["t"] = event.msecs;
+        jsonEvent["latency_ms"] = msecs;
+        jsonEvents << jsonEvent;
+    }
+
+    QJsonObject jsonLatencies;
+    jsonLatencies["all"] = FrameStats::summarize(latencies);
+    for (auto it = typeLatencies.cbegin(); it != typeLatencies.cend(); ++it)
+        jsonLatencies[InteractionSession::typeName((InteractionSession::Event::Type) it.key())] = FrameStats::summarize(it.value());
+
+    QJsonObject report;
+    report["latency_ms"] = jsonLatencies;
+    report["frame_stats"] = m_widget->frameStats().toJson();
+    report["events"] = jsonEvents;
+    return report;
+}
+
+void InteractionReplay::send(const InteractionSession::Event &event)
+{
+    using Event = InteractionSession::Event;
+    const QPointF globalPos = m_widget->mapToGlobal(event.pos);
+    const Qt::MouseButtons buttons = Qt::MouseButtons::fromInt(event.buttons);
+    const Qt::KeyboardModifiers modifiers = Qt::KeyboardModifiers::fromInt(event.modifiers);
+
+    switch (event.type) {
+    case Event::MousePress:
+    case Event::MouseRelease:
+    case Event::MouseDoubleClick:
+    case Event::MouseMove: {
+        const QEvent::Type type = (event.type == Event::MousePress) ? QEvent::MouseButtonPress
+                : (event.type == Event::MouseRelease) ? QEvent::MouseButtonRelease
+                : (event.type == Event::MouseDoubleClick) ? QEvent::MouseButtonDblClick
+                : QEvent::MouseMove;
+        QMouseEvent mouseEvent(type, event.pos, globalPos, (Qt::MouseButton) event.button, buttons, modifiers);
+        QCoreApplication::sendEvent(m_widget, &mouseEvent);
+        break;
+    }
+    case Event::Wheel: {
+        QWheelEvent wheelEvent(event.pos, globalPos, QPoint(), event.angleDelta, buttons, modifiers, Qt::NoScrollPhase, false);
+        QCoreApplication::sendEvent(m_widget, &wheelEvent);
+        break;
+    }
+    case Event::KeyPress: {
+        QKeyEvent keyEvent(QEvent::KeyPress, event.key, modifiers);
+        QCoreApplication::sendEvent(m_widget, &keyEvent);
+        break;
+    }
+    case Event::Resize:
+        m_widget->resize(event.size);
+        break;
+    }
+}
+
+void InteractionReplay::waitForFrames()
+{
+    // every event is followed by at least one frame, e.g. to draw the hovered outline
+    bool drawn = false;
+    for (;;) {
+        QCoreApplication::processEvents();
+
+        // the layout only follows the widget size once resizing paused for a moment
+        if (m_widget->isResizePending()) {
+            QCoreApplication::processEvents(QEventLoop::WaitForMoreEvents);
+            continue;
+        }
+        if (drawn && !m_widget->isRenderPending())
+            break;
+
+        m_widget->repaint();
+        m_widget->waitForRenderWorker();
+        drawn = true;
+    }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QObject>
+#include <QPointer>
+#include <QPoint>
+#include <QPointF>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QJsonObject>
+
+class TreeMapWidget;
+
+/**
+ * The input events that a TreeMapWidget received during one session, i.e.
+ * wheel zooming, panning, double-click zooming, hovering, key presses and
+ * resizes, in the order in which they arrived.
+ */
+class InteractionSession
+{
+public:
+    struct Event
+    {
+        enum Type { MousePress, MouseRelease, MouseDoubleClick, MouseMove, Wheel, KeyPress, Resize };
+        Type type = MouseMove;
+        qint64 msecs = 0;   // since the start of the recording
+        QPointF pos;
+        int button = 0;     // Qt::MouseButton
+        int buttons = 0;    // Qt::MouseButtons
+        int modifiers = 0;  // Qt::KeyboardModifiers
+        int key = 0;
+        QPoint angleDelta;
+        QSize size;         // only set for resizes
+    };
+
+    QSize initialSize;
+    QVector<Event> events;
+
+    bool save(const QString &fileName) const;
+    bool load(const QString &fileName);
+
+    static QString typeName(Event::Type type);
+};
+
+/** Records the input events of a widget into a session */
+class InteractionRecorder : public QObject
+{
+    Q_OBJECT
+
+public:
+    InteractionRecorder(TreeMapWidget *widget);
+    ~InteractionRecorder();
+
+    const InteractionSession &session() const { return m_session; }
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+    QPointer<TreeMapWidget> m_widget;
+    InteractionSession m_session;
+    QElapsedTimer m_timer;
+};
+
+/**
+ * Replays a session against a TreeMapWidget as fast as the widget can follow:
+ * after each event, frames are drawn until the widget has caught up with it,
+ * i.e. all render lists it caused have been built and drawn. The time this
+ * takes is the event's latency.
+ */
+class InteractionReplay
+{
+public:
+    InteractionReplay(TreeMapWidget *widget);
+
+    /** Returns per-event latencies, and the widget's frame statistics as JSON */
+    QJsonObject run(const InteractionSession &session);
+
+private:
+    void send(const InteractionSession::Event &event);
+    void waitForFrames();
+
+    TreeMapWidget *m_widget;
+};
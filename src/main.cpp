@@ -1,10 +1,47 @@
 #include "mainwindow.h"
+#include "benchmark.h"
 #include "codemodel.h"
 #include "codemodeldialog.h"
+#include "util.h"
+#include "interactionsession.h"
+#include "synthetictreemapprovider.h"
 
 #include <QApplication>
 #include <QFileInfo>
 #include <QDir>
+#include <QFile>
+#include <QJsonDocument>
+#include <QScopedPointer>
+
+/** Size of the --benchmark-layout tree, unless given by --synthetic */
+static constexpr int LAYOUT_BENCHMARK_NODES = 1000000;
+
+/** Writes the report as JSON into the given file, or stdout if none is given */
+static bool writeReport(const QJsonObject &report, const QString &reportFile)
+{
+    const QByteArray json = QJsonDocument(report).toJson();
+
+    QFile file(reportFile);
+    if (reportFile.isEmpty() ? !file.open(stdout, QIODevice::WriteOnly) : !file.open(QIODevice::WriteOnly))
+        return false;
+    return file.write(json) == json.size();
+}
+
+/** Replays a recorded session against a fresh tree map, and writes the latency report */
+static bool replaySession(const InteractionSession &session, const QString &sessionFile,
+                          const QSharedPointer<const TreeMapDataProvider> &provider,
+                          bool software, const QString &reportFile)
+{
+    TreeMapWidget widget;
+    widget.setSoftwareRendering(software);
+    widget.setNodeTree(TreeMapWidget::buildNodeTree(provider, widget.font()));
+
+    QJsonObject report = InteractionReplay(&widget).run(session);
+    report["session"] = sessionFile;
+    report["nodes"] = provider->nodeCount();
+    report["software"] = software;
+    return writeReport(report, reportFile);
+}
 
 int main(int argc, char *argv[])
 {
@@ -17,10 +54,70 @@ int main(int argc, char *argv[])
     MainWindow mainWindow;
     CodeModelDialog dialog;
 
+    // with --export, the tree map of the given folders is written into an image
+    // file without showing any windows, e.g. with QT_QPA_PLATFORM=offscreen
+    QString exportFile;
+    QSize exportSize(30000, 20000);
+
+    // with --record, the input events of the tree map are written into a session
+    // file on exit. --replay plays such a session back as fast as possible, either
+    // against the given folders or a --synthetic tree of N nodes, and reports
+    // event latencies and frame statistics as JSON, e.g. with QT_QPA_PLATFORM=offscreen
+    QString recordFile;
+    QString replayFile;
+    QString reportFile;
+    int syntheticNodes = 0;
+    bool softwareReplay = false;
+
+    // --benchmark-squarify times the layout of single directories, and
+    // --benchmark-layout the layout of a --synthetic tree with an increasing
+    // number of threads, which also checks hit-testing against a linear scan.
+    // Both write their timings as JSON into the --report file, or stdout
+    bool squarifyBenchmark = false;
+    bool layoutBenchmark = false;
+
     // read folders/files from cmd line
     if (argc > 1) {
         QStringList folders;
         for (int i = 1; i < argc; ++i) {
+            const QString arg = QString::fromLocal8Bit(argv[i]);
+            if (arg == "--export" && i + 1 < argc) {
+                exportFile = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (arg == "--export-size" && i + 1 < argc) {
+                exportSize = parseSize(QString::fromLocal8Bit(argv[++i]));
+                continue;
+            }
+            if (arg == "--record" && i + 1 < argc) {
+                recordFile = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (arg == "--replay" && i + 1 < argc) {
+                replayFile = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (arg == "--report" && i + 1 < argc) {
+                reportFile = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (arg == "--synthetic" && i + 1 < argc) {
+                syntheticNodes = QString::fromLocal8Bit(argv[++i]).toInt();
+                continue;
+            }
+            if (arg == "--software") {
+                softwareReplay = true;
+                continue;
+            }
+            if (arg == "--benchmark-squarify") {
+                squarifyBenchmark = true;
+                continue;
+            }
+            if (arg == "--benchmark-layout") {
+                layoutBenchmark = true;
+                continue;
+            }
+
             QFileInfo fileInfo(argv[i]);
             if (fileInfo.isReadable()) {
                 QString path = fileInfo.absoluteFilePath();
@@ -32,6 +129,62 @@ int main(int argc, char *argv[])
         dialog.setFolders(folders);
     }
 
+    if (squarifyBenchmark)
+        return writeReport(benchmarkSquarify(), reportFile) ? 0 : 1;
+    if (layoutBenchmark) {
+        // the layout benchmark also checks hit-testing, and fails if it disagrees with a linear scan
+        const QJsonObject report = benchmarkLayout(syntheticNodes > 0 ? syntheticNodes : LAYOUT_BENCHMARK_NODES);
+        if (!writeReport(report, reportFile))
+            return 1;
+        return report["hit_test"].toObject()["mismatches"].toInt() == 0 ? 0 : 1;
+    }
+
+    if (!exportFile.isEmpty()) {
+        if (exportSize.isEmpty()) {
+            qWarning("--export-size has to be given as WIDTHxHEIGHT");
+            return 1;
+        }
+        QObject::connect(&mainWindow, &MainWindow::treeMapChanged, [&]() {
+            const bool success = mainWindow.exportTreeMap(exportFile, exportSize);
+            if (!success)
+                qWarning("Could not export the tree map to %s", qPrintable(exportFile));
+            QCoreApplication::exit(success ? 0 : 1);
+        });
+        mainWindow.setCodeDetails(dialog.folders(), dialog.excluded(), dialog.endings());
+        return a.exec();
+    }
+
+    if (!replayFile.isEmpty()) {
+        InteractionSession session;
+        if (!session.load(replayFile)) {
+            qWarning("Could not read the session %s", qPrintable(replayFile));
+            return 1;
+        }
+
+        if (syntheticNodes > 0) {
+            const QSharedPointer<const TreeMapDataProvider> provider(new SyntheticTreeMapProvider(syntheticNodes));
+            return replaySession(session, replayFile, provider, softwareReplay, reportFile) ? 0 : 1;
+        }
+
+        QObject::connect(&mainWindow, &MainWindow::treeMapChanged, [&]() {
+            const bool success = replaySession(session, replayFile, mainWindow.treeMapProvider(), softwareReplay, reportFile);
+            if (!success)
+                qWarning("Could not write the replay report");
+            QCoreApplication::exit(success ? 0 : 1);
+        });
+        mainWindow.setCodeDetails(dialog.folders(), dialog.excluded(), dialog.endings());
+        return a.exec();
+    }
+
+    QScopedPointer<InteractionRecorder> recorder;
+    if (!recordFile.isEmpty()) {
+        recorder.reset(new InteractionRecorder(mainWindow.m_treeMap));
+        QObject::connect(&a, &QCoreApplication::aboutToQuit, [&]() {
+            if (!recorder->session().save(recordFile))
+                qWarning("Could not write the session %s", qPrintable(recordFile));
+        });
+    }
+
     QObject::connect(&dialog, &CodeModelDialog::accepted, [&]() {
         mainWindow.setCodeDetails(dialog.folders(), dialog.excluded(), dialog.endings());
         dialog.hide();
@@ -1,6 +1,9 @@
 #include "mainwindow.h"
 #include "persistent.h"
 #include "codeutil.h"
+#include "codetreemapprovider.h"
+#include "treemapexporter.h"
+#include "util.h"
 #include "hsluv-c/src/hsluv.h"
 
 #include <QSplitter>
@@ -10,6 +13,13 @@
 #include <QDesktopServices>
 #include <QUrl>
 #include <QTimer>
+#include <QSignalBlocker>
+#include <QApplication>
+#include <QFileDialog>
+#include <QInputDialog>
+#include <QMessageBox>
+#include <QFile>
+#include <QJsonDocument>
 
 static QColor hv2qcolor(float hue, float value)
 {
@@ -18,7 +28,7 @@ static QColor hv2qcolor(float hue, float value)
     return QColor(255 * r, 255 * g, 255 * b);
 }
 
-static QHash<QString, QColor> getColorPalette(const FileEndingStats::Stats &endings)
+static QVector<QColor> getColorPalette(const FileEndingStats::Stats &endings)
 {
     // build hue list
     QVector<float> hues{220.f, 360.f, 60.f, 120.f, 30.f, 180.f, 310.f, 275.f, 80.f};
@@ -27,56 +37,13 @@ static QHash<QString, QColor> getColorPalette(const FileEndingStats::Stats &endi
     while (hues.size() > endings.size())
         hues.removeLast();
 
-    QHash<QString, QColor> ret;
-    for (int i = 0; i < endings.size(); ++i)
-        ret[endings[i].ending] = hv2qcolor(hues[i], 80.f);
-
-    return ret;
-}
-
-TreeMapNode nodeForFile(const File *file, const QHash<QString, QColor> &palette)
-{
-    TreeMapNode ret{};
-    ret.label = file->name() + "." + file->ending();
-    ret.groupLabel = ret.label;
-    ret.color = palette[file->ending()];
-    ret.size = file->loc();
-    ret.userData = (void*) file;
-    return ret;
-}
-
-TreeMapNode nodeForDir(
-        const Directory *dir, const QStringList &excludeList,
-        const QString &removePrefix, const FileEndingStats::DirStats &endingStats,
-        const QHash<QString, QColor> &palette)
-{
-    TreeMapNode ret{};
-    ret.label = dir->name();
-    ret.groupLabel = dir->fullName();
-    ret.size = 0;
-    ret.userData = (void*) dir;
-
-    if (!removePrefix.isEmpty() && ret.groupLabel.startsWith(removePrefix))
-        ret.groupLabel = ret.groupLabel.mid(removePrefix.size());
-
-    float r = 0.0f, g = 0.0f, b = 0.0f;
-
-    for (const CodeItem *child : dir->children()) {
-        if (!excludeList.contains(child->path())) {
-            if (child->type() == CodeItem::Type_File) {
-                ret.children << nodeForFile((File*) child, palette);
-                ret.size += child->loc();
-            } else {
-                ret.children << nodeForDir((Directory*) child, excludeList, removePrefix, endingStats, palette);
-                ret.size += ret.children.last().size;
-            }
-
-            r += ret.children.last().color.red() * ret.children.last().size;
-            g += ret.children.last().color.green() * ret.children.last().size;
-            b += ret.children.last().color.blue() * ret.children.last().size;
-        }
+    // palette is indexed by file ending id
+    QVector<QColor> ret(FileEndingStats::endingCount());
+    for (int i = 0; i < endings.size(); ++i) {
+        if (endings[i].id >= ret.size())
+            ret.resize(endings[i].id + 1);
+        ret[endings[i].id] = hv2qcolor(hues[i], 80.f);
     }
-    ret.color = QColor(r / ret.size, g / ret.size, b / ret.size);
 
     return ret;
 }
@@ -130,6 +97,7 @@ void MainWindow::setupWidgets()
     m_treeMap = new TreeMapWidget();
     connect(m_treeMap, &TreeMapWidget::nodeSelected, this, &MainWindow::onTreeMapNodeSelected, Qt::DirectConnection);
     connect(m_treeMap, &TreeMapWidget::nodeRightClicked, this, &MainWindow::onTreeMapNodeRightClicked, Qt::DirectConnection);
+    connect(m_treeMap, &TreeMapWidget::settingsChanged, this, &MainWindow::onTreeMapSettingsChanged);
 
     //
     // Right Pane
@@ -165,6 +133,12 @@ void MainWindow::setupWidgets()
     m_groupSlider->setOrientation(Qt::Horizontal);
     m_groupSlider->setTickInterval(1);
 
+    m_softwareRenderingCheckBox = new QCheckBox("Software Rendering", treeMapSettingsGroup);
+    m_softwareRenderingCheckBox->setChecked(m_treeMap->softwareRendering());
+
+    m_frameStatsCheckBox = new QCheckBox("Frame Statistics", treeMapSettingsGroup);
+    m_frameStatsCheckBox->setChecked(m_treeMap->frameStatsVisible());
+
     QVBoxLayout *treeMapSettingsGroupLayout = new QVBoxLayout(treeMapSettingsGroup);
     treeMapSettingsGroupLayout->setContentsMargins(0, 0, 0, 0);
     treeMapSettingsGroupLayout->addWidget(m_depthLabel);
@@ -173,6 +147,8 @@ void MainWindow::setupWidgets()
     treeMapSettingsGroupLayout->addWidget(m_sizeSlider);
     treeMapSettingsGroupLayout->addWidget(m_groupLabel);
     treeMapSettingsGroupLayout->addWidget(m_groupSlider);
+    treeMapSettingsGroupLayout->addWidget(m_softwareRenderingCheckBox);
+    treeMapSettingsGroupLayout->addWidget(m_frameStatsCheckBox);
 
     //
     // Selected Entity
@@ -205,15 +181,23 @@ void MainWindow::setupWidgets()
     m_menubar->setGeometry(QRect(0, 0, 800, 22));
     setMenuBar(m_menubar);
 
+    QMenu *fileMenu = m_menubar->addMenu("File");
+    QAction *exportAction = fileMenu->addAction("Export Image...");
+    connect(exportAction, &QAction::triggered, this, &MainWindow::onExportTreeMap);
+    QAction *saveStatsAction = fileMenu->addAction("Save Frame Statistics...");
+    connect(saveStatsAction, &QAction::triggered, this, &MainWindow::onSaveFrameStats);
+
     m_statusbar = new QStatusBar(this);
     m_statusbar->setObjectName(QString::fromUtf8("statusbar"));
     setStatusBar(m_statusbar);
 
-    connect(m_depthSlider, &QSlider::valueChanged, this, &MainWindow::updateLabels);
-    connect(m_sizeSlider, &QSlider::valueChanged, this, &MainWindow::updateLabels);
-    connect(m_groupSlider, &QSlider::valueChanged, this, &MainWindow::updateLabels);
+    connect(m_depthSlider, &QSlider::valueChanged, this, &MainWindow::onSettingsSliderChanged);
+    connect(m_sizeSlider, &QSlider::valueChanged, this, &MainWindow::onSettingsSliderChanged);
+    connect(m_groupSlider, &QSlider::valueChanged, this, &MainWindow::onSettingsSliderChanged);
+    connect(m_softwareRenderingCheckBox, &QCheckBox::toggled, m_treeMap, &TreeMapWidget::setSoftwareRendering);
+    connect(m_frameStatsCheckBox, &QCheckBox::toggled, m_treeMap, &TreeMapWidget::setFrameStatsVisible);
 
-    updateLabels();
+    onSettingsSliderChanged();
 }
 
 void MainWindow::onCodeModelProgress()
@@ -261,6 +245,57 @@ void MainWindow::onCacheDataChanged(const QByteArray &data)
     PersistentData::setCacheData(data);
 }
 
+bool MainWindow::exportTreeMap(const QString &fileName, const QSize &size)
+{
+    if (!m_treeMapProvider || size.isEmpty())
+        return false;
+
+    // the widget's tree is bound to its layouter, so the exporter gets its own
+    const QFont font = m_treeMap->font();
+    TreeMapExporter exporter(size, font);
+    exporter.setMaxDepth(m_treeMap->maxDepth());
+    exporter.setMaxSize(m_treeMap->maxSize());
+    exporter.setMinGroupSize(m_treeMap->minGroupSize());
+    exporter.setNodeTree(TreeMapLayouter::buildNodeTree(m_treeMapProvider, font));
+    return exporter.exportImage(fileName);
+}
+
+void MainWindow::onExportTreeMap()
+{
+    const QString fileName = QFileDialog::getSaveFileName(this, "Export Image", QString(), "PNG Image (*.png);;SVG Image (*.svg)");
+    if (fileName.isEmpty())
+        return;
+
+    bool ok = false;
+    const QString sizeText = QString("%1x%2").arg(m_exportSize.width()).arg(m_exportSize.height());
+    const QSize size = parseSize(QInputDialog::getText(this, "Export Image", "Image size in pixels:", QLineEdit::Normal, sizeText, &ok));
+    if (!ok)
+        return;
+    if (size.isEmpty()) {
+        QMessageBox::warning(this, "Export Image", "The image size has to be given as WIDTHxHEIGHT.");
+        return;
+    }
+    m_exportSize = size;
+
+    QApplication::setOverrideCursor(Qt::WaitCursor);
+    const bool success = exportTreeMap(fileName, size);
+    QApplication::restoreOverrideCursor();
+
+    if (!success)
+        QMessageBox::warning(this, "Export Image", "Could not export the tree map to " + fileName);
+}
+
+void MainWindow::onSaveFrameStats()
+{
+    const QString fileName = QFileDialog::getSaveFileName(this, "Save Frame Statistics", QString(), "JSON (*.json)");
+    if (fileName.isEmpty())
+        return;
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(QJsonDocument(m_treeMap->frameStats().toJson()).toJson()) < 0)
+        QMessageBox::warning(this, "Save Frame Statistics", "Could not write " + fileName);
+}
+
 void MainWindow::setCodeDetails(QStringList paths, QStringList excluded, QStringList endings)
 {
     PersistentData::setIncludePaths(paths);
@@ -280,25 +315,35 @@ void MainWindow::maybeUpdateTreeMapWidget()
     if (m_model->state() != CodeModel::State_Done)
         return;
 
-    // if there is only one root node, we can remove its prefix from all
-    // groupLabels along the way
-    const QVector<const Directory*> rootDirs =  m_model->rootDirs();
-    const QString removePrefix = (rootDirs.size() == 1) ? rootDirs.first()->fullName() : QString();
-
-    // collect File Ending Stats for each Directory and assign file ending colors
-    const FileEndingStats::DirStats endingStats = FileEndingStats::getDirStats(rootDirs, m_excludeList);
-    const QHash<QString, QColor> palette = getColorPalette(endingStats.total);
-
-    // build root TreeMapNode
-    TreeMapNode rootNode{"root", "root", QColor(), 0.0f, {}, nullptr};
-    for (const Directory *dir : rootDirs) {
-        if (!m_excludeList.contains(dir->path())) {
-            rootNode.children << nodeForDir(dir, m_excludeList, removePrefix, endingStats, palette);
-            rootNode.size += rootNode.children.last().size;
-        }
-    }
+    // Building the tree map nodes traverses the whole model, so we do it on the
+    // model thread, where it can't race with model updates, and only hand
+    // the finished node tree back to the GUI thread.
+    const int generation = ++m_treeMapGeneration;
+    const QStringList excludeList = m_excludeList;
+    const QFont font = m_treeMap->font();
+
+    QTimer::singleShot(0, m_model.data(), [=]() {
+        if (m_model->state() != CodeModel::State_Done)
+            return;
+
+        const QVector<const Directory*> rootDirs =  m_model->rootDirs();
 
-    m_treeMap->setRootNode(rootNode);
+        // collect File Ending Stats for each Directory and assign file ending colors
+        const FileEndingStats::DirStats endingStats = FileEndingStats::getDirStats(rootDirs, excludeList);
+        const QVector<QColor> palette = getColorPalette(FileEndingStats::sorted(endingStats.total));
+
+        QSharedPointer<const TreeMapDataProvider> provider(new CodeTreeMapProvider(rootDirs, excludeList, palette));
+        const QSharedPointer<TreeMapLayouter::NodeTree> nodeTree = TreeMapLayouter::buildNodeTree(provider, font);
+
+        QTimer::singleShot(0, this, [=]() {
+            // a newer tree may have been requested in the meantime
+            if (generation == m_treeMapGeneration) {
+                m_treeMapProvider = provider;
+                m_treeMap->setNodeTree(nodeTree);
+                emit treeMapChanged();
+            }
+        });
+    });
 }
 
 void MainWindow::updateLabels()
@@ -306,14 +351,32 @@ void MainWindow::updateLabels()
     m_depthLabel->setText(QString("Max Depth: %1").arg(m_depthSlider->value()));
     m_sizeLabel->setText(QString("Max Item Size: %1").arg(m_sizeSlider->value()));
     m_groupLabel->setText(QString("Min Group Size: %1").arg(m_groupSlider->value()));
+}
+
+void MainWindow::onSettingsSliderChanged()
+{
+    updateLabels();
+
+    // each setter may report back and reset the sliders, so read all of them first
+    const int maxDepth = m_depthSlider->value();
+    const int maxSize = m_sizeSlider->value();
+    const int minGroupSize = m_groupSlider->value();
+    m_treeMap->setMaxDepth(maxDepth);
+    m_treeMap->setMaxSize(maxSize);
+    m_treeMap->setMinGroupSize(minGroupSize);
+}
 
-    m_treeMap->setMaxDepth(m_depthSlider->value());
-    m_treeMap->setMaxSize(m_sizeSlider->value());
-    m_treeMap->setMinGroupSize(m_groupSlider->value());
+void MainWindow::onTreeMapSettingsChanged()
+{
+    // show the values the layouter clamped the settings to, without applying them again
+    const QSignalBlocker depthBlocker(m_depthSlider);
+    const QSignalBlocker sizeBlocker(m_sizeSlider);
+    const QSignalBlocker groupBlocker(m_groupSlider);
 
     m_depthSlider->setValue(m_treeMap->maxDepth());
     m_sizeSlider->setValue(m_treeMap->maxSize());
     m_groupSlider->setValue(m_treeMap->minGroupSize());
+    updateLabels();
 }
 
 void MainWindow::onTreeMapNodeSelected(void *userData)
@@ -2,6 +2,7 @@
 
 #include <QMainWindow>
 #include <QSlider>
+#include <QCheckBox>
 #include <QLabel>
 #include <QStatusBar>
 #include <QMenuBar>
@@ -25,18 +26,29 @@ public:
 
     TreeMapWidget *m_treeMap;
 
+    /** Lays out the current tree map at the given size, and writes it into a PNG or SVG file */
+    bool exportTreeMap(const QString &fileName, const QSize &size);
+
+    /** The data behind the current tree map, which stays valid after the code model changes */
+    QSharedPointer<const TreeMapDataProvider> treeMapProvider() const { return m_treeMapProvider; }
+
 private slots:
     void maybeUpdateTreeMapWidget();
     void updateLabels();
+    void onSettingsSliderChanged();
+    void onTreeMapSettingsChanged();
     void onTreeMapNodeSelected(void *userData);
     void onTreeMapNodeRightClicked(void *userData, QPoint pos);
     void onCodeModelProgress();
     void updateProgressBar();
     void onAbort();
     void onCacheDataChanged(const QByteArray &data);
+    void onExportTreeMap();
+    void onSaveFrameStats();
 
 signals:
     void abort();
+    void treeMapChanged();
 
 private:
     void setupWidgets();
@@ -46,6 +58,8 @@ private:
     QSlider *m_sizeSlider;
     QLabel *m_groupLabel;
     QSlider *m_groupSlider;
+    QCheckBox *m_softwareRenderingCheckBox;
+    QCheckBox *m_frameStatsCheckBox;
     QMenuBar *m_menubar;
     QStatusBar *m_statusbar;
 
@@ -56,6 +70,9 @@ private:
     QPointer<CodeModel> m_model;
 
     QStringList m_excludeList;
+    int m_treeMapGeneration = 0;
+    QSharedPointer<const TreeMapDataProvider> m_treeMapProvider;
+    QSize m_exportSize = QSize(30000, 20000);
 
     QMutex m_modelStateMutex;
     ProgressBar *m_progressBar;
@@ -0,0 +1,157 @@
+#include "pngstreamwriter.h"
+
+#include <QtEndian>
+
+#include <zlib.h>
+
+/** Size of the compression buffer, and thereby the max. size of a single IDAT chunk */
+static constexpr int IDAT_CHUNK_SIZE = 256 * 1024;
+
+static constexpr int PNG_COMPRESSION_LEVEL = 6;
+
+struct PngStreamWriter::Stream
+{
+    z_stream z = {};
+    bool initialized = false;
+
+    ~Stream()
+    {
+        if (initialized)
+            deflateEnd(&z);
+    }
+};
+
+PngStreamWriter::PngStreamWriter(QIODevice *device, const QSize &size)
+    : m_stream(new Stream())
+    , m_device(device)
+    , m_size(size)
+{
+}
+
+PngStreamWriter::~PngStreamWriter()
+{
+}
+
+bool PngStreamWriter::begin()
+{
+    if (m_size.isEmpty() || m_stream->initialized)
+        return false;
+
+    if (deflateInit(&m_stream->z, PNG_COMPRESSION_LEVEL) != Z_OK)
+        return false;
+    m_stream->initialized = true;
+
+    m_output.resize(IDAT_CHUNK_SIZE);
+    m_stream->z.next_out = (Bytef*) m_output.data();
+    m_stream->z.avail_out = m_output.size();
+
+    // one filter type byte, followed by 8 bit RGB pixels
+    m_line.resize(1 + 3 * m_size.width());
+
+    static const char signature[] = "\x89PNG\r\n\x1a\n";
+    if (m_device->write(signature, 8) != 8)
+        return false;
+
+    QByteArray header(13, 0);
+    qToBigEndian<quint32>(m_size.width(), header.data());
+    qToBigEndian<quint32>(m_size.height(), header.data() + 4);
+    header[8] = 8;  // bit depth
+    header[9] = 2;  // color type RGB
+    header[10] = 0; // deflate
+    header[11] = 0; // adaptive filtering
+    header[12] = 0; // no interlacing
+    return writeChunk("IHDR", header);
+}
+
+bool PngStreamWriter::writeRows(const QImage &image, int rowCount)
+{
+    Q_ASSERT(image.format() == QImage::Format_RGB32);
+    Q_ASSERT(image.width() == m_size.width());
+    rowCount = qMin(qMin(rowCount, image.height()), m_size.height() - m_rows);
+    if (!m_stream->initialized || image.width() != m_size.width())
+        return false;
+
+    uchar *line = (uchar*) m_line.data();
+    const int width = m_size.width();
+    for (int y = 0; y < rowCount; ++y) {
+        const QRgb *src = (const QRgb*) image.constScanLine(y);
+
+        // the Sub filter stores the difference to the pixel on the left
+        line[0] = 1;
+        uchar *dst = line + 1;
+        QRgb left = 0;
+        for (int x = 0; x < width; ++x) {
+            const QRgb px = src[x];
+            dst[3 * x + 0] = (uchar) (qRed(px) - qRed(left));
+            dst[3 * x + 1] = (uchar) (qGreen(px) - qGreen(left));
+            dst[3 * x + 2] = (uchar) (qBlue(px) - qBlue(left));
+            left = px;
+        }
+
+        if (!compress(line, m_line.size(), false))
+            return false;
+        ++m_rows;
+    }
+
+    return true;
+}
+
+bool PngStreamWriter::finish()
+{
+    if (!m_stream->initialized || m_rows != m_size.height())
+        return false;
+
+    if (!compress(nullptr, 0, true))
+        return false;
+
+    return writeChunk("IEND", QByteArray());
+}
+
+bool PngStreamWriter::writeChunk(const char *type, const QByteArray &data)
+{
+    uchar length[4];
+    qToBigEndian<quint32>(data.size(), length);
+
+    // the checksum covers the chunk type and its data
+    uLong crc = crc32(0, (const Bytef*) type, 4);
+    if (!data.isEmpty())
+        crc = crc32(crc, (const Bytef*) data.constData(), data.size());
+    uchar checksum[4];
+    qToBigEndian<quint32>(crc, checksum);
+
+    return m_device->write((const char*) length, 4) == 4
+        && m_device->write(type, 4) == 4
+        && m_device->write(data) == data.size()
+        && m_device->write((const char*) checksum, 4) == 4;
+}
+
+bool PngStreamWriter::compress(const uchar *data, int size, bool finish)
+{
+    z_stream &z = m_stream->z;
+    z.next_in = (Bytef*) data;
+    z.avail_in = size;
+
+    // without Z_FINISH, deflate() only returns early once the output buffer is full
+    for (;;) {
+        const int ret = ::deflate(&z, finish ? Z_FINISH : Z_NO_FLUSH);
+        if (ret == Z_STREAM_ERROR || ret == Z_BUF_ERROR)
+            return false;
+
+        if (z.avail_out == 0) {
+            if (!writeChunk("IDAT", m_output))
+                return false;
+            z.next_out = (Bytef*) m_output.data();
+            z.avail_out = m_output.size();
+        }
+
+        if (finish ? (ret == Z_STREAM_END) : (z.avail_in == 0))
+            break;
+    }
+
+    if (finish && z.avail_out < (uInt) m_output.size()) {
+        if (!writeChunk("IDAT", m_output.left(m_output.size() - z.avail_out)))
+            return false;
+    }
+
+    return true;
+}
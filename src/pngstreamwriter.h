@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QByteArray>
+#include <QImage>
+#include <QIODevice>
+#include <QScopedPointer>
+#include <QSize>
+
+/**
+ * Encodes an RGB image into a PNG file row by row, so that images which
+ * don't fit into memory at once can be written from a sequence of tiles.
+ * QImageWriter can only encode complete images.
+ *
+ * Rows are written with the Sub filter, and compressed into a single zlib
+ * stream, which is split into IDAT chunks whenever its buffer runs full.
+ */
+class PngStreamWriter
+{
+public:
+    PngStreamWriter(QIODevice *device, const QSize &size);
+    ~PngStreamWriter();
+
+    /** Writes the PNG header, has to be called before any rows are added */
+    bool begin();
+
+    /** Appends the first rowCount rows of the given QImage::Format_RGB32 image */
+    bool writeRows(const QImage &image, int rowCount);
+
+    /** Flushes the compressed data and closes the image, once all rows were written */
+    bool finish();
+
+    int rowsWritten() const { return m_rows; }
+
+private:
+    bool writeChunk(const char *type, const QByteArray &data);
+    bool compress(const uchar *data, int size, bool finish);
+
+    struct Stream;
+    QScopedPointer<Stream> m_stream;
+    QIODevice *m_device;
+    QSize m_size;
+    int m_rows = 0;
+    QByteArray m_line;
+    QByteArray m_output;
+};
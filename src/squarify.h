@@ -5,7 +5,6 @@
 #include <numeric>
 #include <algorithm>
 #include <cassert>
-#include <memory>
 
 namespace Squarify {
 
@@ -13,6 +12,7 @@ struct Rect
 {
     Rect() : x(0.0f), y(0.0f), width(0.0f), height(0.0f) {}
     Rect(const Rect&) = default;
+    Rect &operator=(const Rect&) = default;
     Rect(float _x, float _y, float _w, float _h) : x(_x), y(_y), width(_w), height(_h) {}
 
     float x;
@@ -21,110 +21,88 @@ struct Rect
     float height;
 };
 
-struct TreeMapNode
+struct Element
 {
-    struct Element
-    {
-        size_t index;
-        Rect rect;
-    };
-
-    TreeMapNode() = default;
-    TreeMapNode(TreeMapNode&& o) = default;
-    ~TreeMapNode() = default;
-    TreeMapNode& operator=(TreeMapNode&& o) = default;
-
-    // would result in undefined 'next' ownership
-    TreeMapNode(const TreeMapNode &) = delete;
-    TreeMapNode &operator=(const TreeMapNode&) = delete;
+    /** index into the input sizes */
+    size_t index;
+    Rect rect;
+};
 
+/**
+ * One row of the squarified layout, i.e. one level of subdivision.
+ */
+struct Row
+{
     /**
-     * The area encapsulated by both the elements in this hierarchy level,
-     * plus all the child nodes
+     * The area encapsulated by both the elements in this row,
+     * plus all the rows that follow
      */
     Rect bounds;
 
-    /**
-     * Elements included in this hierarchy level
-     */
-    std::vector<Element> elements;
-
-    /**
-     * If non-null: Further subdivision of more elements.
-     * Is owned by this TreeMapNode and will be de-allocated on destruction.
-     */
-    std::unique_ptr<TreeMapNode> next;
+    /** Elements in this row are [begin, end[ in the element buffer */
+    size_t begin;
+    size_t end;
 };
 
+/**
+ * Computes squarified treemap layouts.
+ *
+ * The layout is computed iteratively, row by row, and written into buffers
+ * provided by the caller. Both these and the internal buffers are only
+ * cleared between runs, so re-using a Squarify object and the output buffers
+ * for many layouts doesn't cause any heap allocations once they have grown
+ * large enough.
+ */
 class Squarify
 {
 private:
-    struct Element {
+    struct Item {
         size_t originalIndex;
         float size;
     };
-    std::vector<Element> m_elements;
-
-    // to avoid unnecessary allocations/deallocations during operation
-    mutable std::vector<Rect> m_rectBuf;
-
-    Rect m_rect;
+    std::vector<Item> m_items;
 
-    static float aspectRatio(const Rect &rect)
-    {
-        return (rect.width > rect.height)
-                ? (rect.width / rect.height)
-                : (rect.height / rect.width);
-    }
-
-    /** Denotes a range [from, to[ in m_elements */
-    struct Span
-    {
-        size_t begin;
-        size_t end;
-        size_t len() const { return end - begin; }
-    };
-
-    float sum(Span span) const
+    /**
+     * Worst aspect ratio within a row of elements with the given total, smallest
+     * and largest size, when laid out along an edge of the given length.
+     *
+     * The row has a thickness of t = sum / side, and an element of size s
+     * spans s / t along the edge, so its aspect ratio is max(t^2 / s, s / t^2).
+     */
+    static float worstRatio(float sum, float minSize, float maxSize, float side)
     {
-        float sum = 0.0f;
-        for (size_t i = span.begin; i < span.end; ++i)
-            sum += m_elements[i].size;
-        return sum;
+        const float side2 = side * side;
+        const float sum2 = sum * sum;
+        return std::max(side2 * maxSize / sum2, sum2 / (side2 * minSize));
     }
 
     /**
-     * If the given rectangle is horizontal, layout the given sizes vertically.
-     * If the given rectangle is vertical, layout the given sizes horizontally.
+     * If the given rectangle is horizontal, layout the given items vertically.
+     * If the given rectangle is vertical, layout the given items horizontally.
      */
-    void layout(std::vector<Rect> &dst, Span span, const Rect &rect) const
+    void layout(std::vector<Element> &dst, size_t begin, size_t end, float area, const Rect &rect) const
     {
-        dst.clear();
-        const float area = sum(span);
-
         if (rect.width < rect.height) {
             float height = area / rect.width;
             float x = rect.x;
-            for (size_t i = span.begin; i < span.end; ++i) {
-                dst.push_back(Rect{x, rect.y, m_elements[i].size / height, height});
-                x += m_elements[i].size / height;
+            for (size_t i = begin; i < end; ++i) {
+                dst.push_back(Element{m_items[i].originalIndex, Rect{x, rect.y, m_items[i].size / height, height}});
+                x += m_items[i].size / height;
             }
         }
         else {
             float width = area / rect.height;
             float y = rect.y;
-            for (size_t i = span.begin; i < span.end; ++i) {
-                dst.push_back(Rect{rect.x, y, width, m_elements[i].size / width});
-                y += m_elements[i].size / width;
+            for (size_t i = begin; i < end; ++i) {
+                dst.push_back(Element{m_items[i].originalIndex, Rect{rect.x, y, width, m_items[i].size / width}});
+                y += m_items[i].size / width;
             }
         }
     }
 
-    /** Cut off the amount of size from the longest edge of the rect */
-    Rect leftover(Span span, const Rect &rect) const
+    /** Cut off the amount of area from the longest edge of the rect */
+    static Rect leftover(float area, const Rect &rect)
     {
-        const float area = sum(span);
-
         if (rect.width < rect.height) {
             float height = area / rect.width;
             return Rect{rect.x, rect.y + height, rect.width, rect.height - height};
@@ -135,102 +113,78 @@ private:
         }
     }
 
-    float worstRatio(std::vector<Rect> &dst, Span span, const Rect &rect) const
-    {
-        assert(span.len() > 0);
-        layout(dst, span, rect);
-        float worst = aspectRatio(dst[0]);
-        for (size_t i = 1; i < dst.size(); ++i)
-            worst = std::max(worst, aspectRatio(dst[1]));
-        return worst;
-    }
-
-    TreeMapNode squarify(Span s, const Rect &rect) const
+public:
+    /**
+     * Lays out the given sizes within rect. rows and elements are cleared, and then
+     * receive the rows in order, and the elements of each row.
+     */
+    void compute(const std::vector<float> &sizes, const Rect &rect, std::vector<Row> &rows, std::vector<Element> &elements)
     {
-        assert(s.len() > 0);
-
-        TreeMapNode ret;
-        ret.bounds = rect;
-
-        size_t split = s.begin + 1;
-        float ratio = worstRatio(m_rectBuf, Span{s.begin, split}, rect);
-        while (split < s.end) {
-            const float newRatio = worstRatio(m_rectBuf, Span{s.begin, split + 1}, rect);
-            if (ratio >= newRatio) {
-                ratio = newRatio;
-                ++split;
-            }
-            else
-                break;
-        }
-
-        const Span current = Span{s.begin, split};
-        const Span remaining = Span{split, s.end};
-        const Rect left = leftover(current, rect);
+        rows.clear();
+        elements.clear();
+        m_items.clear();
 
-        layout(m_rectBuf, current, rect);
-        assert(m_rectBuf.size() == current.len());
-        ret.elements.reserve(m_rectBuf.size());
-        for (size_t i = 0; i < m_rectBuf.size(); ++i) {
-            ret.elements.push_back({m_elements[current.begin + i].originalIndex, m_rectBuf[i]});
-        }
-
-        if (remaining.len() > 0) {
-            ret.next.reset(new TreeMapNode());
-            *ret.next = squarify(remaining, left);
-        }
-
-        return ret;
-    }
+        if (sizes.empty())
+            return;
 
-    static void gather(std::vector<TreeMapNode::Element> &dst, const TreeMapNode &node)
-    {
-        for (const TreeMapNode::Element &e : node.elements)
-            dst.push_back(e);
-        if (node.next)
-            gather(dst, *node.next);
-    }
-
-public:
-    Squarify(const std::vector<float> &sizes, const Rect &rect)
-        : m_rect(rect)
-    {
         const float sum = std::accumulate(sizes.begin(), sizes.end(), 0.0f);
         const float area = rect.width * rect.height;
 
-        m_elements.reserve(sizes.size());
         for (size_t i = 0; i < sizes.size(); ++i) {
-            m_elements.push_back({i, sizes[i] * area / sum});
+            m_items.push_back({i, sizes[i] * area / sum});
         }
 
-        std::sort(m_elements.begin(), m_elements.end(), [](Element a, Element b) {
+        std::sort(m_items.begin(), m_items.end(), [](Item a, Item b) {
             return a.size > b.size;
         });
-    }
 
-    ~Squarify() {}
+        Rect remaining = rect;
+        size_t begin = 0;
+        while (begin < m_items.size()) {
+            // grow the row as long as the worst aspect ratio improves, keeping running
+            // sums so that every candidate is evaluated in O(1)
+            const float side = std::min(remaining.width, remaining.height);
+            size_t split = begin + 1;
+            float rowSum = m_items[begin].size;
+            float rowMin = rowSum;
+            float rowMax = rowSum;
+            float ratio = worstRatio(rowSum, rowMin, rowMax, side);
+            while (split < m_items.size()) {
+                const float size = m_items[split].size;
+                const float newSum = rowSum + size;
+                const float newMin = std::min(rowMin, size);
+                const float newMax = std::max(rowMax, size);
+                const float newRatio = worstRatio(newSum, newMin, newMax, side);
+                if (ratio >= newRatio) {
+                    ratio = newRatio;
+                    rowSum = newSum;
+                    rowMin = newMin;
+                    rowMax = newMax;
+                    ++split;
+                }
+                else
+                    break;
+            }
 
-    TreeMapNode computeWithHierarchy()
-    {
-        m_rectBuf.reserve(m_elements.size());
-        return squarify(Span{0, m_elements.size()}, m_rect);
+            rows.push_back(Row{remaining, elements.size(), elements.size() + (split - begin)});
+            layout(elements, begin, split, rowSum, remaining);
+            assert(elements.size() == rows.back().end);
+
+            remaining = leftover(rowSum, remaining);
+            begin = split;
+        }
     }
 
-    std::vector<Rect> compute()
+    /** Convenience function, returns the rects in the order of the input sizes */
+    static std::vector<Rect> compute(const std::vector<float> &sizes, const Rect &rect)
     {
-        const TreeMapNode tree = computeWithHierarchy();
-
-        std::vector<TreeMapNode::Element> elements;
-        gather(elements, tree);
-
-        const auto compareIndex = [](const TreeMapNode::Element &a, const TreeMapNode::Element &b) {
-            return a.index < b.index;
-        };
-        std::sort(elements.begin(), elements.end(), compareIndex);
+        std::vector<Row> rows;
+        std::vector<Element> elements;
+        Squarify().compute(sizes, rect, rows, elements);
 
-        std::vector<Rect> ret;
-        for (const TreeMapNode::Element &e : elements)
-            ret.push_back(e.rect);
+        std::vector<Rect> ret(sizes.size());
+        for (const Element &e : elements)
+            ret[e.index] = e.rect;
 
         return ret;
     }
@@ -0,0 +1,73 @@
+#include "synthetictreemapprovider.h"
+
+#include <QRandomGenerator>
+#include <QString>
+
+#include <cmath>
+
+static const char *s_endings[] = {"cpp", "h", "c", "py", "js", "java", "rs", "go"};
+static constexpr int ENDING_COUNT = sizeof(s_endings) / sizeof(s_endings[0]);
+
+SyntheticTreeMapProvider::SyntheticTreeMapProvider(int nodeCount, quint32 seed)
+    : m_items(qMax(1, nodeCount))
+{
+    QRandomGenerator rng(seed);
+
+    // directories are filled breadth-first, so the children of a node have
+    // consecutive ids, which are all larger than their parent's
+    QVector<int> dirs{0};
+    int nextId = 1;
+    for (int head = 0; head < dirs.size() && nextId < m_items.size(); ++head) {
+        const int id = dirs[head];
+        const int count = qMin((int) rng.bounded(2, 24), (int) m_items.size() - nextId);
+        m_items[id].firstChild = nextId;
+        m_items[id].childCount = count;
+
+        // keep at least one directory queued, until all nodes have been placed
+        const bool lastDir = (head + 1 == dirs.size());
+        for (int i = 0; i < count; ++i) {
+            const int childId = nextId++;
+            m_items[childId].parent = id;
+            if (rng.bounded(5) == 0 || (lastDir && i == 0))
+                dirs << childId;
+        }
+    }
+
+    // nodes without children are files, and directories sum them up
+    QColor palette[ENDING_COUNT];
+    for (int i = 0; i < ENDING_COUNT; ++i)
+        palette[i] = QColor::fromHsv(360 * i / ENDING_COUNT, 140, 230);
+
+    for (int id = m_items.size() - 1; id >= 0; --id) {
+        Item &item = m_items[id];
+        if (item.childCount == 0) {
+            item.ending = rng.bounded(ENDING_COUNT);
+            item.size = qRound(std::exp(rng.generateDouble() * 8.0));
+            item.color = palette[item.ending].rgb();
+        } else {
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            for (int i = 0; i < item.childCount; ++i) {
+                const Item &child = m_items[item.firstChild + i];
+                r += qRed(child.color) * child.size;
+                g += qGreen(child.color) * child.size;
+                b += qBlue(child.color) * child.size;
+            }
+            item.color = qRgb(r / item.size, g / item.size, b / item.size);
+        }
+
+        if (item.parent >= 0)
+            m_items[item.parent].size += item.size;
+    }
+}
+
+SyntheticTreeMapProvider::~SyntheticTreeMapProvider()
+{
+}
+
+QString SyntheticTreeMapProvider::label(int node) const
+{
+    const Item &item = m_items[node];
+    if (item.ending >= 0)
+        return QString("file%1.%2").arg(node).arg(s_endings[item.ending]);
+    return QString("dir%1").arg(node);
+}
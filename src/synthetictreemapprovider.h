@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QVector>
+#include <QColor>
+
+#include "treemapdataprovider.h"
+
+/**
+ * A random, but reproducible tree of the given size, which looks roughly
+ * like a source tree: directories with a varying number of children, and
+ * files with a long-tailed size distribution, colored by their "ending".
+ *
+ * Used to benchmark the tree map without scanning a code base first.
+ */
+class SyntheticTreeMapProvider : public TreeMapDataProvider
+{
+public:
+    SyntheticTreeMapProvider(int nodeCount, quint32 seed = 1);
+    ~SyntheticTreeMapProvider();
+
+    int nodeCount() const override { return m_items.size(); }
+    int childCount(int node) const override { return m_items[node].childCount; }
+    int child(int node, int index) const override { return m_items[node].firstChild + index; }
+
+    float size(int node) const override { return m_items[node].size; }
+    QColor color(int node) const override { return QColor::fromRgb(m_items[node].color); }
+    QString label(int node) const override;
+    QString groupLabel(int node) const override { return label(node); }
+
+    // the layouter looks nodes up by their user data, so it has to be unique
+    void *userData(int node) const override { return (void*) (quintptr) (node + 1); }
+
+private:
+    struct Item
+    {
+        int parent = -1;
+        int ending = -1; // only set for files
+        float size = 0.0f;
+        QRgb color = 0;
+        int firstChild = 0;
+        int childCount = 0;
+    };
+    QVector<Item> m_items;
+};
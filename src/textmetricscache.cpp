@@ -0,0 +1,39 @@
+#include "textmetricscache.h"
+
+TextMetricsCache::TextMetricsCache(const QFont &font)
+    : m_font(font)
+    , m_metrics(font)
+{
+}
+
+void TextMetricsCache::setFont(const QFont &font)
+{
+    if (m_font == font)
+        return;
+
+    m_font = font;
+    m_metrics = QFontMetricsF(font);
+    m_advances.clear();
+    m_sizes.clear();
+}
+
+QSizeF TextMetricsCache::size(const QString &text)
+{
+    const auto it = m_sizes.constFind(text);
+    if (it != m_sizes.constEnd())
+        return it.value();
+
+    ++m_measureCount;
+
+    qreal width = 0.0;
+    for (const QChar c : text) {
+        auto advance = m_advances.find(c);
+        if (advance == m_advances.end())
+            advance = m_advances.insert(c, m_metrics.horizontalAdvance(c));
+        width += advance.value();
+    }
+
+    const QSizeF size(width, m_metrics.height());
+    m_sizes.insert(text, size);
+    return size;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QFont>
+#include <QFontMetricsF>
+#include <QHash>
+#include <QSizeF>
+#include <QString>
+
+/**
+ * Caches the sizes of single-line strings rendered with one font.
+ *
+ * Widths are estimated as the sum of the per-glyph advances, which are
+ * cached separately, so measuring a new string doesn't need to shape it.
+ * Kerning is ignored, which over-estimates widths by a few pixels at most.
+ */
+class TextMetricsCache
+{
+public:
+    TextMetricsCache(const QFont &font = QFont());
+
+    QFont font() const { return m_font; }
+    void setFont(const QFont &font);
+
+    QSizeF size(const QString &text);
+
+    /** Number of strings that were not found in the cache, and had to be measured */
+    int measureCount() const { return m_measureCount; }
+
+private:
+    QFont m_font;
+    QFontMetricsF m_metrics;
+    QHash<QChar, qreal> m_advances;
+    QHash<QString, QSizeF> m_sizes;
+    int m_measureCount = 0;
+};
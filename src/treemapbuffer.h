@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+#include <QColor>
+#include <QOpenGLBuffer>
+#include <QPointF>
+#include <QRectF>
+#include <QScopedArrayPointer>
+#include <QString>
+
+#include "glyphatlas.h"
+#include "treemapinstance.h"
+
+/**
+ * Staging memory for instance data. Buffers are kept across frames and only
+ * cleared, so they only allocate while growing to their high-water mark.
+ */
+class Buffer
+{
+public:
+    Buffer(uint sz = 1 << 16) : m_reserved(sz), m_allocated(sz), m_bytes(new quint8[sz]) {}
+    void clear() { m_size = 0; m_available = 0; }
+    const void *data() const { return (const void*) m_bytes.data(); }
+    int size() const { return m_size; }
+
+    /** Returns the number of bytes allocated since the last call */
+    uint takeAllocatedBytes() { const uint ret = m_allocated; m_allocated = 0; return ret; }
+
+    /**
+     * Streams the data into the given GL buffer. Its previous storage is
+     * orphaned instead of being overwritten, so we don't have to wait for the
+     * GPU to finish reading it, and it is only re-allocated to grow.
+     */
+    void upload(QOpenGLBuffer &glBuffer, int &glCapacity) const
+    {
+        if (size() > glCapacity)
+            glCapacity = qMax(size(), 2 * glCapacity);
+        glBuffer.bind();
+        glBuffer.allocate(glCapacity);
+        glBuffer.write(0, data(), size());
+    }
+
+    void reserve(uint sz) {
+        resize(m_size + sz);
+        m_available += sz;
+    }
+
+    Buffer &operator<<(quint8 v) { write(v); return *this; }
+    Buffer &operator<<(qint16 v) { write(v); return *this; }
+    Buffer &operator<<(quint16 v) { write(v); return *this; }
+    Buffer &operator<<(float v) { write(v); return *this; }
+    Buffer &operator<<(const QColor &color) {
+        write<quint8>(color.red());
+        write<quint8>(color.green());
+        write<quint8>(color.blue());
+        write<quint8>(color.alpha());
+        return *this;
+    }
+
+private:
+    void resize(uint n) {
+        if (n < m_reserved)
+            return;
+
+        uint newSize = m_reserved;
+        while (newSize <= n)
+            newSize *= 2;
+
+        quint8 *newData = new quint8[newSize];
+        memcpy(newData, m_bytes.data(), m_size);
+        m_bytes.reset(newData);
+        m_reserved = newSize;
+        m_allocated += newSize;
+    }
+
+    template <class T> void write(T v) {
+        assert(m_size + sizeof(T) <= m_available);
+        void *dst = (void*) &m_bytes[m_size];
+        assert(((alignof (T) - 1) & (uintptr_t) dst) == 0);
+        *((T*) dst) = v;
+        m_size += sizeof(T);
+    }
+
+    uint m_reserved = 0;
+    uint m_allocated = 0;
+    uint m_available = 0;
+    uint m_size = 0;
+    QScopedArrayPointer<quint8> m_bytes;
+};
+
+class VertexBuffer : public Buffer
+{
+public:
+    VertexBuffer() : Buffer() {}
+    void add(const QRectF &rect, const QColor &bg)
+    {
+        add(NodeInstance(rect, bg));
+    }
+
+    void add(const NodeInstance &instance)
+    {
+        reserve(stride());
+        *this << instance.x << instance.y << instance.w << instance.h << instance.r << instance.g << instance.b << instance.a;
+    }
+
+    const NodeInstance &operator[](int idx) const { return ((const NodeInstance*) data())[idx]; }
+    const NodeInstance *instances() const { return (const NodeInstance*) data(); }
+
+    int vertices() const { return size() / stride(); }
+    constexpr static int stride() { return sizeof(NodeInstance); }
+};
+
+/** One GlyphInstance per glyph, see treemapinstance.h */
+class LabelBuffer : public Buffer
+{
+public:
+    LabelBuffer() : Buffer() {}
+
+    /** Adds the glyphs of the given text, centered on the anchor */
+    void add(GlyphAtlas &atlas, const QPointF &anchor, const QString &text,
+             float minScale = 0.0f, float maxScale = std::numeric_limits<float>::infinity())
+    {
+        if (minScale >= maxScale)
+            return;
+
+        float x = -0.5f * atlas.textWidth(text);
+        const float y = -0.5f * atlas.lineHeight();
+        GlyphAtlas::forEachCodePoint(text, [&](char32_t codePoint) {
+            const GlyphAtlas::Glyph &glyph = atlas.glyph(codePoint);
+            if (!glyph.size.isEmpty()) {
+                reserve(stride());
+                *this << (float) anchor.x() << (float) anchor.y()
+                      << (qint16) qRound(x) << (qint16) qRound(y)
+                      << (qint16) glyph.size.width() << (qint16) glyph.size.height()
+                      << (quint16) glyph.atlasPos.x() << (quint16) glyph.atlasPos.y()
+                      << minScale << maxScale;
+            }
+            x += glyph.advance;
+        });
+    }
+
+    const GlyphInstance *instances() const { return (const GlyphInstance*) data(); }
+
+    int glyphs() const { return size() / stride(); }
+    constexpr static int stride() { return sizeof(GlyphInstance); }
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <QString>
+#include <QColor>
+
+/**
+ * Interface through which TreeMapLayouter queries the tree it lays out.
+ *
+ * Nodes are addressed by ids in [0, nodeCount()[, the root node always has the id 0.
+ * A provider is never modified after being handed to the layouter, so it may
+ * be queried from any thread.
+ */
+class TreeMapDataProvider
+{
+public:
+    virtual ~TreeMapDataProvider() {}
+
+    virtual int nodeCount() const = 0;
+    virtual int childCount(int node) const = 0;
+    virtual int child(int node, int index) const = 0;
+
+    virtual float size(int node) const = 0;
+    virtual QColor color(int node) const = 0;
+    virtual QString label(int node) const = 0;
+    virtual QString groupLabel(int node) const = 0;
+    virtual void *userData(int node) const = 0;
+};
@@ -0,0 +1,207 @@
+#include "treemapexporter.h"
+
+#include "treemapbuffer.h"
+#include "treemaprasterizer.h"
+#include "pngstreamwriter.h"
+
+#include <QFileInfo>
+#include <QFontInfo>
+#include <QSaveFile>
+#include <QXmlStreamWriter>
+
+/** Number of image rows that are rasterized and compressed at once */
+static constexpr int EXPORT_STRIP_HEIGHT = 256;
+
+TreeMapExporter::TreeMapExporter(const QSize &size, const QFont &font)
+    : TreeMapLayouter(size.width(), size.height())
+    , m_size(size)
+    , m_font(font)
+    , m_glyphAtlas(font)
+{
+}
+
+TreeMapExporter::~TreeMapExporter()
+{
+}
+
+void TreeMapExporter::forEachVisibleNode(const NodeVisitor &visitor)
+{
+    // same as the instances of TreeMapWidget, but only the ones that are
+    // visible at the export's zoom scale
+    const float lodScale = viewScale();
+    const auto visit = [&](const Node &node, float minScale) {
+        if (minScale > lodScale)
+            return;
+        float fitScale, maxScale;
+        const QString label = nodeLabel(node);
+        labelScaleRange(node, QSizeF(m_glyphAtlas.textWidth(label), m_glyphAtlas.lineHeight()), fitScale, maxScale);
+        visitor(node, lodScale >= qMax(minScale, fitScale) && lodScale < maxScale);
+    };
+
+    visit(*m_renderedNode, 0.0f);
+    for (const Node *parent : laidOutNodes()) {
+        const float minScale = childMinScale(*parent);
+        forEachLaidOutChild(*parent, [&](const Node &child) {
+            if (maxDepth() <= 0 || child.depth - m_renderedNode->depth <= maxDepth())
+                visit(child, minScale);
+        });
+    }
+}
+
+void TreeMapExporter::forEachGroup(const GroupVisitor &visitor)
+{
+    traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
+        if (!node.groupViewRect.isNull() || !node.groupLabelRect.isNull())
+            visitor(node);
+        return node.responsibleForGroup;
+    });
+}
+
+bool TreeMapExporter::exportImage(const QString &fileName)
+{
+    if (QFileInfo(fileName).suffix().compare("svg", Qt::CaseInsensitive) == 0)
+        return exportSvg(fileName);
+    return exportPng(fileName);
+}
+
+bool TreeMapExporter::exportPng(const QString &fileName)
+{
+    // instances are kept at full precision, so the only limit is the memory of a strip
+    QImage strip(m_size.width(), qMin(EXPORT_STRIP_HEIGHT, m_size.height()), QImage::Format_RGB32);
+    if (strip.isNull())
+        return false;
+
+    // labels are culled here already, so all of them are added without a zoom range
+    VertexBuffer nodes;
+    LabelBuffer labels;
+    forEachVisibleNode([&](const Node &node, bool labelVisible) {
+        nodes.add(node.sceneRect, nodeColor(node));
+        if (labelVisible)
+            labels.add(m_glyphAtlas, node.sceneRect.center(), nodeLabel(node));
+    });
+
+    VertexBuffer groups;
+    LabelBuffer groupLabels;
+    forEachGroup([&](const Node &node) {
+        if (!node.groupViewRect.isNull())
+            groups.add(node.groupViewRect, QColor(0, 0, 0, 0));
+        if (!node.groupLabelRect.isNull())
+            groupLabels.add(m_glyphAtlas, node.groupLabelRect.center(), nodeGroupLabel(node));
+    });
+
+    TreeMapRasterizer rasterizer;
+    const QVector<float> minScales(nodes.vertices(), 0.0f);
+    rasterizer.addNodes(nodes.instances(), minScales.constData(), nodes.vertices());
+    rasterizer.addLabels(labels.instances(), labels.glyphs());
+    rasterizer.setGlyphAtlas(m_glyphAtlas.image());
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    PngStreamWriter png(&file, m_size);
+    if (!png.begin())
+        return false;
+
+    // the last strip may extend beyond the image, and is cut off by the writer
+    for (int top = 0; top < m_size.height(); top += strip.height()) {
+        TreeMapRasterizer::Frame frame;
+        frame.screenSize = strip.size();
+        frame.viewport = viewToScene(QRectF(QPointF(0, top), strip.size()));
+        frame.lodScale = viewScale();
+        frame.viewOffset = QPointF(0, -top);
+        frame.groups = groups.instances();
+        frame.groupCount = groups.vertices();
+        frame.groupLabels = groupLabels.instances();
+        frame.groupLabelCount = groupLabels.glyphs();
+        rasterizer.render(strip, frame);
+
+        if (!png.writeRows(strip, m_size.height() - top))
+            return false;
+    }
+
+    return png.finish() && file.commit();
+}
+
+bool TreeMapExporter::exportSvg(const QString &fileName)
+{
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QXmlStreamWriter xml(&file);
+    const auto num = [](qreal value) { return QString::number(value); };
+    const auto writeRect = [&](const QRectF &rect) {
+        xml.writeEmptyElement("rect");
+        xml.writeAttribute("x", num(rect.x()));
+        xml.writeAttribute("y", num(rect.y()));
+        xml.writeAttribute("width", num(rect.width()));
+        xml.writeAttribute("height", num(rect.height()));
+    };
+    const auto writeText = [&](const QPointF &center, const QString &text) {
+        xml.writeStartElement("text");
+        xml.writeAttribute("x", num(center.x()));
+        xml.writeAttribute("y", num(center.y()));
+        xml.writeCharacters(text);
+        xml.writeEndElement();
+    };
+    const auto beginTextGroup = [&](const QString &color) {
+        xml.writeStartElement("g");
+        xml.writeAttribute("font-family", m_font.family());
+        xml.writeAttribute("font-size", QString("%1px").arg(QFontInfo(m_font).pixelSize()));
+        xml.writeAttribute("text-anchor", "middle");
+        xml.writeAttribute("dominant-baseline", "central");
+        xml.writeAttribute("fill", color);
+    };
+
+    xml.writeStartDocument();
+    xml.writeStartElement("svg");
+    xml.writeDefaultNamespace("http://www.w3.org/2000/svg");
+    xml.writeAttribute("width", num(m_size.width()));
+    xml.writeAttribute("height", num(m_size.height()));
+    xml.writeAttribute("viewBox", QString("0 0 %1 %2").arg(m_size.width()).arg(m_size.height()));
+
+    // SVG has no equivalent of the cushion shading, so nodes are outlined instead
+    xml.writeStartElement("g");
+    xml.writeAttribute("stroke", "#000000");
+    xml.writeAttribute("stroke-opacity", "0.3");
+    xml.writeAttribute("stroke-width", "0.5");
+    forEachVisibleNode([&](const Node &node, bool) {
+        const QColor color = nodeColor(node);
+        writeRect(sceneToView(node.sceneRect));
+        xml.writeAttribute("fill", color.name());
+        if (color.alpha() < 255)
+            xml.writeAttribute("fill-opacity", num(color.alphaF()));
+    });
+    xml.writeEndElement();
+
+    beginTextGroup("#000000");
+    forEachVisibleNode([&](const Node &node, bool labelVisible) {
+        if (labelVisible)
+            writeText(sceneToView(node.sceneRect).center(), nodeLabel(node));
+    });
+    xml.writeEndElement();
+
+    xml.writeStartElement("g");
+    xml.writeAttribute("fill", "none");
+    xml.writeAttribute("stroke", "#000000");
+    xml.writeAttribute("stroke-opacity", "0.6");
+    xml.writeAttribute("stroke-width", "4");
+    forEachGroup([&](const Node &node) {
+        if (!node.groupViewRect.isNull())
+            writeRect(node.groupViewRect.adjusted(2, 2, -2, -2));
+    });
+    xml.writeEndElement();
+
+    beginTextGroup("#ffffff");
+    forEachGroup([&](const Node &node) {
+        if (!node.groupLabelRect.isNull())
+            writeText(node.groupLabelRect.center(), nodeGroupLabel(node));
+    });
+    xml.writeEndElement();
+
+    xml.writeEndElement();
+    xml.writeEndDocument();
+
+    return !xml.hasError() && file.commit();
+}
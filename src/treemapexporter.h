@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QFont>
+#include <QSize>
+#include <QString>
+
+#include "treemaplayouter.h"
+#include "glyphatlas.h"
+
+/**
+ * Lays out a node tree once at an arbitrary resolution, without a widget or
+ * GL context, and writes the result into an image file. Nodes, labels and
+ * groups are culled with the same rules as in TreeMapWidget.
+ *
+ * PNG images are rasterized by TreeMapRasterizer in strips, which are
+ * compressed as soon as they are done, so only a single strip of the image
+ * is held in memory. SVG documents are streamed element by element.
+ */
+class TreeMapExporter : public TreeMapLayouter
+{
+public:
+    TreeMapExporter(const QSize &size, const QFont &font);
+    ~TreeMapExporter();
+
+    QSize size() const { return m_size; }
+
+    bool exportPng(const QString &fileName);
+    bool exportSvg(const QString &fileName);
+
+    /** Chooses the format by the file's suffix */
+    bool exportImage(const QString &fileName);
+
+protected:
+    void onNodeTreeChanged() override {}
+    void onLayoutChanged() override {}
+    void onViewportChanged() override {}
+
+private:
+    using NodeVisitor = std::function<void(const Node &node, bool labelVisible)>;
+    using GroupVisitor = std::function<void(const Node &node)>;
+
+    /** Visits all nodes that are drawn at the export resolution, parents before their children */
+    void forEachVisibleNode(const NodeVisitor &visitor);
+
+    /** Visits all nodes with a group outline or label */
+    void forEachGroup(const GroupVisitor &visitor);
+
+    QSize m_size;
+    QFont m_font;
+    GlyphAtlas m_glyphAtlas;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QRectF>
+#include <QColor>
+
+/**
+ * Per-instance data of a single rect in scene space. The size is kept at
+ * full precision as well, as the view may be zoomed in far enough for a
+ * rounding error of a tiny node to span many pixels.
+ */
+struct NodeInstance
+{
+    NodeInstance() = default;
+    NodeInstance(const QRectF &rect, const QColor &color)
+        : x(rect.left())
+        , y(rect.top())
+        , w(rect.width())
+        , h(rect.height())
+        , r(color.red())
+        , g(color.green())
+        , b(color.blue())
+        , a(color.alpha())
+    {
+    }
+
+    float x = 0.0f;
+    float y = 0.0f;
+    float w = 0.0f;
+    float h = 0.0f;
+    quint8 r = 0;
+    quint8 g = 0;
+    quint8 b = 0;
+    quint8 a = 0;
+};
+static_assert(sizeof(NodeInstance) == 20, "NodeInstance must be 20 bytes");
+
+/**
+ * A single glyph quad of a label: the label's anchor is given in scene
+ * space, the glyph's offset from it and its size in view space pixels, and
+ * the label is only visible for zoom scales in [minScale, maxScale[.
+ *
+ * The scales are kept at full precision, as half floats would overflow at
+ * deep zoom levels, and move the switch to the children's labels.
+ */
+struct GlyphInstance
+{
+    float anchorX = 0.0f;
+    float anchorY = 0.0f;
+    qint16 x = 0;
+    qint16 y = 0;
+    qint16 w = 0;
+    qint16 h = 0;
+    quint16 atlasX = 0;
+    quint16 atlasY = 0;
+    float minScale = 0.0f;
+    float maxScale = 0.0f;
+};
+static_assert(sizeof(GlyphInstance) == 28, "GlyphInstance must be 28 bytes");
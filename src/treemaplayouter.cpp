@@ -2,16 +2,38 @@
 
 #include <memory>
 #include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <limits>
 
 #include <QtMath>
 #include <QDebug>
+#include <QElapsedTimer>
 
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 
 static constexpr float GROUP_LABEL_OFFSET = 5.0f;
 
-using SquarifyNode = Squarify::TreeMapNode;
+/** Batches of nodes with fewer children than this are laid out on the calling thread */
+static constexpr int PARALLEL_LAYOUT_MIN_CHILDREN = 4096;
+
+/** The culling rect extends the viewport by this fraction of its size on each side */
+static constexpr float CULLING_PADDING = 0.25f;
+
+/** Memory budget of cached layouts, in bytes */
+static constexpr int LAYOUT_CACHE_SIZE = 64 * 1024 * 1024;
+
+/** Children that would cover fewer pixels than this when laid out are aggregated into a bucket */
+static constexpr float BUCKET_PIXEL_AREA = 4.0f;
+
+/** With a layout time budget, newly visible nodes are laid out in batches of this size */
+static constexpr int BUDGET_LAYOUT_BATCH = 256;
+
+/** The index of group ratios is rebuilt by a full pass once it holds this many entries per visible node, plus the minimum */
+static constexpr int GROUP_INDEX_ENTRIES_PER_NODE = 4;
+static constexpr int GROUP_INDEX_MIN_ENTRIES = 4096;
+
 using Squarify::Rect;
 
 static QRectF scaled(const QRectF &rect, float scale)
@@ -29,227 +51,746 @@ static Rect QRectToRect(const QRectF &r)
     return Rect(r.left(), r.top(), r.width(), r.height());
 }
 
+/** Largest zoom ratio at which a group label of the given size still fits into the rect */
+static float ratioLimit(const QRectF &sceneRect, const QRectF &labelBounds)
+{
+    return qMin(sceneRect.width() / (labelBounds.width() + 2.f * GROUP_LABEL_OFFSET),
+                sceneRect.height() / (labelBounds.height() + 2.f * GROUP_LABEL_OFFSET));
+}
+
+static float minSide(const QRectF &rect)
+{
+    return qMin(rect.width(), rect.height());
+}
+
+/** Provides a single, empty root node until real data is set */
+class EmptyDataProvider : public TreeMapDataProvider
+{
+public:
+    int nodeCount() const override { return 1; }
+    int childCount(int) const override { return 0; }
+    int child(int, int) const override { return -1; }
+    float size(int) const override { return 0.0f; }
+    QColor color(int) const override { return QColor(); }
+    QString label(int) const override { return QString(); }
+    QString groupLabel(int) const override { return QString(); }
+    void *userData(int) const override { return nullptr; }
+};
+
 TreeMapLayouter::TreeMapLayouter(int width, int height)
-    : m_width(width)
+    : m_provider(new EmptyDataProvider())
+    , m_width(width)
     , m_height(height)
+    , m_nodes(1)
+    , m_layoutCache(LAYOUT_CACHE_SIZE)
 {
+    m_renderedNode = &m_nodes[0];
 }
 
 TreeMapLayouter::~TreeMapLayouter()
 {
 }
 
-void TreeMapLayouter::setRootNode(const TreeMapNode &root)
+struct TreeMapLayouter::NodeTree
+{
+    QSharedPointer<const TreeMapDataProvider> provider;
+    QVector<Node> nodes;
+    QVector<Subdivision> subdivisions;
+    QVector<int> subdivisionNodes;
+    QHash<void*, int> userDataIndex;
+    int bucketCount = 0;
+    QFont font;
+};
+
+QSharedPointer<TreeMapLayouter::NodeTree> TreeMapLayouter::buildNodeTree(const QSharedPointer<const TreeMapDataProvider> &provider, const QFont &font)
 {
-    m_root.children.clear();
+    QSharedPointer<NodeTree> tree(new NodeTree());
+    tree->provider = provider ? provider : QSharedPointer<const TreeMapDataProvider>(new EmptyDataProvider());
+    tree->nodes.resize(tree->provider->nodeCount());
+
+    tree->font = font;
+
+    // group labels are only measured once they are needed, see groupLabelBounds()
+    int childSlots = 0;
+    rebuildNodeTree(*tree, 0, -1, 0, childSlots);
+
+    // every node that may aggregate its tiny children gets a bucket node,
+    // which are appended after the nodes of the provider
+    const int providerNodes = tree->nodes.size();
+    tree->nodes.resize(providerNodes + tree->bucketCount);
+    for (int id = 0; id < providerNodes; ++id) {
+        Node &node = tree->nodes[id];
+        if (node.bucket < 0)
+            continue;
+        node.bucket += providerNodes;
+
+        Node &bucket = tree->nodes[node.bucket];
+        bucket.id = node.bucket;
+        bucket.parent = id;
+        bucket.depth = node.depth + 1;
+    }
+
+    // allocate the layout arrays up-front, so they can be filled from any thread
+    tree->subdivisions.resize(childSlots);
+    tree->subdivisionNodes.resize(childSlots);
+
+    return tree;
+}
+
+void TreeMapLayouter::setNodeTree(const QSharedPointer<NodeTree> &tree)
+{
+    Q_ASSERT(!tree->nodes.isEmpty());
+
+    m_provider = tree->provider;
+    m_nodes = std::move(tree->nodes);
+    m_subdivisions = std::move(tree->subdivisions);
+    m_subdivisionNodes = std::move(tree->subdivisionNodes);
+    m_userDataIndex = std::move(tree->userDataIndex);
+    m_textMetrics.setFont(tree->font);
+    m_layoutCache.clear();
+    m_renderedNode = &m_nodes[0];
     m_zoomStack.clear();
     m_viewport = QRectF(0, 0, m_width, m_height);
 
-    rebuildNodeTree(m_root, root, 0);
-    m_renderedNode = &m_root;
+    // the group index refers to the previous nodes
+    m_groupDirtyNodes.clear();
+    m_groupMinRatios.clear();
+    m_groupMaxRatios.clear();
+    m_groupStatesValid = false;
 
-    relayoutTreeMapping(m_treeRoot, *m_renderedNode, m_viewport);
-    updateCulling(m_treeRoot);
-    updateGroupRendering(&m_treeRoot);
+    resetTreeMapping(m_viewport);
+    updateCulling();
+    updateGroupRendering();
 
     onNodeTreeChanged();
     onLayoutChanged();
     onViewportChanged();
 }
 
-void TreeMapLayouter::rebuildNodeTree(Node &dstNode, const TreeMapNode &srcNode, int depth)
+void TreeMapLayouter::rebuildNodeTree(NodeTree &tree, int id, int parent, int depth, int &childSlots)
+{
+    const int childCount = tree.provider->childCount(id);
+
+    // in case of duplicates, the first node in DFS order wins
+    void *userData = tree.provider->userData(id);
+    if (userData && !tree.userDataIndex.contains(userData))
+        tree.userDataIndex.insert(userData, id);
+
+    Node &node = tree.nodes[id];
+    node.id = id;
+    node.parent = parent;
+    node.depth = depth;
+    node.childOffset = childSlots;
+    childSlots += childCount;
+
+    // a bucket takes up one more slot, and places its own nodes in the unused tail
+    if (childCount >= 2) {
+        node.bucket = tree.bucketCount++;
+        childSlots += 1;
+    }
+
+    for (int i = 0; i < childCount; ++i)
+        rebuildNodeTree(tree, tree.provider->child(id, i), id, depth + 1, childSlots);
+}
+
+void TreeMapLayouter::resetTreeMapping(const QRectF &rect)
 {
-    dstNode.label = srcNode.label;
-    dstNode.groupLabel = srcNode.groupLabel;
-    dstNode.groupLabelBounds = getTextBounds(dstNode.groupLabel);
-    dstNode.groupLabelBounds.translate(-dstNode.groupLabelBounds.topLeft());
-    dstNode.color = srcNode.color;
-    dstNode.size = srcNode.size;
-    dstNode.userData = srcNode.userData;
+    ++m_layoutGeneration;
+    m_cullingValid = false;
+    m_laidOutNodes.clear();
+    m_layoutNsecs = 0;
+    m_renderedNode->sceneRect = rect;
+
+    // the rendered node covers the whole widget when it is laid out
+    const float pixels = (float) m_width * m_height;
+    m_bucketThreshold = (pixels > 0.0f) ? m_provider->size(m_renderedNode->id) * BUCKET_PIXEL_AREA / pixels : 0.0f;
+    restoreLayout();
+}
 
-    dstNode.depth = depth;
-    dstNode.children.resize(srcNode.children.size());
-    for (int i  = 0; i < dstNode.children.size(); ++i) {
-        rebuildNodeTree(dstNode.children[i], srcNode.children[i], depth + 1);
+void TreeMapLayouter::storeLayout()
+{
+    CachedLayout *layout = new CachedLayout();
+
+    // the rendered node and everything below it that has been placed so far
+    QVector<Node*> stack{m_renderedNode};
+    while (!stack.isEmpty()) {
+        Node *node = stack.takeLast();
+        const bool laidOut = isLaidOut(*node);
+        layout->nodes << CachedLayout::NodeLayout{node->id, node->treeDepth, laidOut ? node->subdivisionCount : -1,
+                                                  node->childOffset, node->bucketCount, node->bucketSize, node->sceneRect};
+        if (!laidOut || node->subdivisionCount == 0)
+            continue;
+
+        const Subdivision *subdivs = m_subdivisions.constData() + node->childOffset;
+        const Subdivision &lastSubdiv = subdivs[node->subdivisionCount - 1];
+        const int nodeCount = lastSubdiv.firstNode + lastSubdiv.nodeCount - node->childOffset;
+        const int *subdivNodes = m_subdivisionNodes.constData() + node->childOffset;
+
+        std::copy(subdivs, subdivs + node->subdivisionCount, std::back_inserter(layout->subdivisions));
+        std::copy(subdivNodes, subdivNodes + nodeCount, std::back_inserter(layout->subdivisionNodes));
+        for (int i = 0; i < nodeCount; ++i)
+            stack << &m_nodes[subdivNodes[i]];
     }
+
+    const int cost = layout->nodes.size() * sizeof(CachedLayout::NodeLayout)
+            + layout->subdivisions.size() * sizeof(Subdivision)
+            + layout->subdivisionNodes.size() * sizeof(int);
+    m_layoutCache.insert(LayoutCacheKey{m_renderedNode->id, m_renderedNode->sceneRect, m_bucketThreshold}, layout, cost);
 }
 
-void TreeMapLayouter::relayoutTreeMapping(TreeNode &treeNode, Node &node, const QRectF &rect)
+bool TreeMapLayouter::restoreLayout()
 {
-    treeNode.node = &node;
-    treeNode.subdivisions.clear();
-    node.sceneRect = rect;
+    const CachedLayout *layout = m_layoutCache.object(LayoutCacheKey{m_renderedNode->id, m_renderedNode->sceneRect, m_bucketThreshold});
+    if (!layout)
+        return false;
+
+    // nodes were stored in the same order as their subdivisions
+    const Subdivision *subdivs = layout->subdivisions.constData();
+    const int *subdivNodes = layout->subdivisionNodes.constData();
+    for (const CachedLayout::NodeLayout &nodeLayout : layout->nodes) {
+        Node &node = m_nodes[nodeLayout.id];
+        node.treeDepth = nodeLayout.treeDepth;
+        node.childOffset = nodeLayout.childOffset;
+        node.bucketCount = nodeLayout.bucketCount;
+        node.bucketSize = nodeLayout.bucketSize;
+        node.sceneRect = nodeLayout.sceneRect;
+        node.groupRatioLimit = -1.0f;
+        node.groupMinSide = minSide(node.sceneRect);
+        if (nodeLayout.subdivisionCount < 0)
+            continue;
+
+        node.layoutGeneration = m_layoutGeneration;
+        node.subdivisionCount = nodeLayout.subdivisionCount;
+        m_laidOutNodes << &node;
+        if (node.subdivisionCount == 0)
+            continue;
+
+        const Subdivision &lastSubdiv = subdivs[node.subdivisionCount - 1];
+        const int nodeCount = lastSubdiv.firstNode + lastSubdiv.nodeCount - node.childOffset;
+        std::copy(subdivs, subdivs + node.subdivisionCount, m_subdivisions.begin() + node.childOffset);
+        std::copy(subdivNodes, subdivNodes + nodeCount, m_subdivisionNodes.begin() + node.childOffset);
+        subdivs += node.subdivisionCount;
+        subdivNodes += nodeCount;
+    }
+
+    return true;
+}
 
-    std::vector<float> inSizes;
-    QVector<Node*> childNodes;
-    for (Node &child : node.children) {
-        if (child.size > 0.0f) {
-            inSizes.push_back(child.size);
-            childNodes.push_back(&child);
+void TreeMapLayouter::relayoutTreeMapping(Node &node, LayoutBuffers &buffers)
+{
+    node.layoutGeneration = m_layoutGeneration;
+    node.subdivisionCount = 0;
+
+    // a bucket lays out the tiny children of its parent
+    const bool bucket = isBucket(node);
+    const int dataId = bucket ? node.parent : node.id;
+    const int childCount = m_provider->childCount(dataId);
+
+    // children too small to ever be visible at this zoom level are aggregated,
+    // unless this node is itself too small to be split any further
+    int tinyCount = 0;
+    float tinySize = 0.0f;
+    if (!bucket && node.bucket >= 0 && m_provider->size(node.id) >= m_bucketThreshold) {
+        for (int i = 0; i < childCount; ++i) {
+            const float childSize = m_provider->size(m_provider->child(node.id, i));
+            if (childSize > 0.0f && childSize < m_bucketThreshold) {
+                ++tinyCount;
+                tinySize += childSize;
+            }
+        }
+    }
+    const bool aggregate = (tinyCount >= 2);
+
+    buffers.sizes.clear();
+    buffers.childIds.clear();
+    for (int i = 0; i < childCount; ++i) {
+        const int childId = m_provider->child(dataId, i);
+        const float childSize = m_provider->size(childId);
+        const bool tiny = childSize < m_bucketThreshold;
+        if (childSize > 0.0f && (bucket ? tiny : !(aggregate && tiny))) {
+            buffers.sizes.push_back(childSize);
+            buffers.childIds.push_back(childId);
         }
     }
 
-    if (childNodes.isEmpty())
+    if (aggregate) {
+        Node &bucketNode = m_nodes[node.bucket];
+        bucketNode.childOffset = node.childOffset + childCount + 1 - tinyCount;
+        bucketNode.bucketCount = tinyCount;
+        bucketNode.bucketSize = tinySize;
+        buffers.sizes.push_back(tinySize);
+        buffers.childIds.push_back(node.bucket);
+    }
+
+    if (buffers.childIds.empty())
         return;
 
-    const float childTotal = std::accumulate(inSizes.begin(), inSizes.end(), 0);
-    const bool hasUnchildishOverflow = (childTotal < node.size);
-    if (hasUnchildishOverflow)
-        inSizes.push_back(node.size - childTotal);
+    // any size of this node that isn't covered by its children is laid out
+    // as an additional element, which doesn't correspond to any child node
+    const float nodeSize = bucket ? node.bucketSize : m_provider->size(node.id);
+    const float childTotal = std::accumulate(buffers.sizes.begin(), buffers.sizes.end(), 0.0f);
+    if (childTotal < nodeSize)
+        buffers.sizes.push_back(nodeSize - childTotal);
+
+    buffers.squarify.compute(buffers.sizes, QRectToRect(node.sceneRect), buffers.rows, buffers.elements);
+
+    // write directly into this node's slots of the layout arrays
+    Subdivision *subdivisions = m_subdivisions.data() + node.childOffset;
+    int *subdivisionNodes = m_subdivisionNodes.data() + node.childOffset;
+    int nodeCount = 0;
+
+    for (const Squarify::Row &row : buffers.rows) {
+        Subdivision &subdivision = subdivisions[node.subdivisionCount];
+        subdivision.firstNode = node.childOffset + nodeCount;
+        subdivision.nodeCount = 0;
+        subdivision.sceneRect = QRectF();
+
+        Q_ASSERT(row.end > row.begin);
+        for (size_t i = row.begin; i < row.end; ++i) {
+            const Squarify::Element &element = buffers.elements[i];
+            if (element.index >= buffers.childIds.size())
+                continue;
+
+            const int childId = buffers.childIds[element.index];
+            Node &childNode = m_nodes[childId];
+            childNode.treeDepth = node.treeDepth + node.subdivisionCount + 1;
+            childNode.sceneRect = RectToQRect(element.rect);
+            childNode.groupRatioLimit = -1.0f;
+            childNode.groupMinSide = minSide(childNode.sceneRect);
+            subdivision.sceneRect |= childNode.sceneRect;
+
+            subdivisionNodes[nodeCount++] = childId;
+            subdivision.nodeCount++;
+        }
 
-    const Rect inRect = QRectToRect(rect);
-    const SquarifyNode tree = Squarify::Squarify(inSizes, inRect).computeWithHierarchy();
+        if (subdivision.nodeCount > 0) {
+            subdivision.remainingSceneRect = RectToQRect(row.bounds);
+            subdivision.remainingRatioLimit = -1.0f;
+            subdivision.remainingMinSide = minSide(subdivision.remainingSceneRect);
+            node.subdivisionCount++;
+        }
+    }
+}
 
-    int treeDepth = node.treeDepth;
-    for (const SquarifyNode *treeIt = &tree; treeIt != nullptr; treeIt = treeIt->next.get()) {
-        TreeNode::Subdivision subdivision;
-        ++treeDepth;
+void TreeMapLayouter::layoutNodes(QVector<Node*> &nodes)
+{
+    QElapsedTimer timer;
+    timer.start();
+    m_laidOutNodes += nodes;
+
+    int totalChildren = 0;
+    for (const Node *node : nodes)
+        totalChildren += layoutChildCount(*node);
+
+    // small batches aren't worth the overhead of waking up the pool
+    if (nodes.size() < 2 || totalChildren < PARALLEL_LAYOUT_MIN_CHILDREN) {
+        for (Node *node : nodes)
+            relayoutTreeMapping(*node, m_layoutBuffers);
+        m_layoutNsecs += timer.nsecsElapsed();
+        return;
+    }
 
-        Q_ASSERT(!treeIt->elements.empty());
-        for (const SquarifyNode::Element &element : treeIt->elements) {
-            Node *childNode = childNodes[element.index];
+    // hand out the largest nodes first, for a better balance at the end of the batch
+    std::sort(nodes.begin(), nodes.end(), [this](const Node *a, const Node *b) {
+        return layoutChildCount(*a) > layoutChildCount(*b);
+    });
+
+    // every node only writes to its own layout slots and its own children,
+    // so the result doesn't depend on which thread lays out which node
+    std::atomic<int> counter(0);
+    const auto work = [&]() {
+        LayoutBuffers buffers;
+        for (int idx = counter.fetch_add(1); idx < nodes.size(); idx = counter.fetch_add(1))
+            relayoutTreeMapping(*nodes[idx], buffers);
+    };
 
-            TreeNode subNode;
-            childNode->treeDepth = treeDepth;
-            relayoutTreeMapping(subNode, *childNode, RectToQRect(element.rect));
-            subdivision.subnodes << subNode;
+    const int tasks = qMin(m_layoutPool.maxThreadCount(), (int) nodes.size() - 1);
+    for (int i = 0; i < tasks; ++i)
+        m_layoutPool.start(work);
+    work();
+    m_layoutPool.waitForDone();
+    m_layoutNsecs += timer.nsecsElapsed();
+}
+
+void TreeMapLayouter::updateCulling()
+{
+    struct Item
+    {
+        Node *node;
+        bool fullyVisible;
+    };
+
+    ++m_cullGeneration;
+    m_visibleNodes.clear();
+    m_refinementPending = false;
+    std::fill(std::begin(m_renderStateCounts), std::end(m_renderStateCounts), 0);
+
+    // the budget only starts with the first layout, so that every pass refines
+    // at least one batch, even if culling alone takes longer than the budget
+    QElapsedTimer timer;
+
+    const float padX = m_viewport.width() * CULLING_PADDING;
+    const float padY = m_viewport.height() * CULLING_PADDING;
+    m_cullingRect = m_viewport.adjusted(-padX, -padY, padX, padY);
+    m_cullingValid = true;
+
+    // nodes are culled level by level, so that all nodes of one level that
+    // need their children laid out can be laid out in a single batch
+    QVector<Item> level{Item{m_renderedNode, false}};
+    QVector<Item> nextLevel;
+    QVector<Node*> pendingLayout;
+
+    while (!level.isEmpty()) {
+        pendingLayout.clear();
+        for (Item &item : level) {
+            if (!updateCullingState(*item.node, item.fullyVisible))
+                item.node = nullptr;
+            else if (item.node->renderState == RenderChildren && !isLaidOut(*item.node))
+                pendingLayout << item.node;
         }
 
-        subdivision.remainingSceneRect = RectToQRect(treeIt->bounds);
-        treeNode.subdivisions << subdivision;
+        // children are only laid out once they are about to be rendered
+        if (m_layoutTimeBudget > 0)
+            layoutNodesWithinBudget(pendingLayout, timer);
+        else
+            layoutNodes(pendingLayout);
+
+        // only descend into the subdivisions that intersect the culling rect
+        nextLevel.clear();
+        for (const Item &item : level) {
+            if (!item.node || item.node->renderState != RenderChildren)
+                continue;
+            for (int i = 0; i < item.node->subdivisionCount; ++i) {
+                const Subdivision &sub = m_subdivisions[item.node->childOffset + i];
+                bool fullyVisible = item.fullyVisible;
+                if (!fullyVisible) {
+                    // all following subdivisions are contained in the remaining rect
+                    if (!m_cullingRect.intersects(sub.remainingSceneRect))
+                        break;
+                    if (!m_cullingRect.intersects(sub.sceneRect))
+                        continue;
+                    fullyVisible = m_cullingRect.contains(sub.sceneRect);
+                }
+                for (int j = 0; j < sub.nodeCount; ++j)
+                    nextLevel << Item{&m_nodes[m_subdivisionNodes[sub.firstNode + j]], fullyVisible};
+            }
+        }
+        level.swap(nextLevel);
     }
 
-    if (hasUnchildishOverflow) {
-        treeNode.subdivisions.back().subnodes.pop_back();
-        if (treeNode.subdivisions.back().subnodes.empty())
-            treeNode.subdivisions.pop_back();
+    // nodes that started or stopped rendering their children need a new group state
+    for (Node *node : m_visibleNodes) {
+        if ((node->renderState == RenderChildren) != node->groupRenderChildren || node->groupGeneration != m_groupGeneration)
+            markGroupDirty(*node);
     }
 }
 
-void TreeMapLayouter::updateCulling(TreeNode &treeNode, bool fullyVisible, bool culledParent)
+void TreeMapLayouter::layoutNodesWithinBudget(QVector<Node*> &nodes, QElapsedTimer &timer)
 {
-    if (treeNode.node == nullptr)
+    if (nodes.isEmpty())
         return;
+    if (!timer.isValid())
+        timer.start();
+
+    // the largest nodes are refined first, the others keep showing their aggregate color
+    std::sort(nodes.begin(), nodes.end(), [](const Node *a, const Node *b) {
+        return a->sceneRect.width() * a->sceneRect.height() > b->sceneRect.width() * b->sceneRect.height();
+    });
+
+    QVector<Node*> batch;
+    int done = 0;
+    while (done < nodes.size() && timer.elapsed() < m_layoutTimeBudget) {
+        const int count = qMin(BUDGET_LAYOUT_BATCH, (int) nodes.size() - done);
+        batch.clear();
+        for (int i = 0; i < count; ++i)
+            batch << nodes[done + i];
+        layoutNodes(batch);
+        done += count;
+    }
 
-    if (culledParent) {
-        treeNode.node->renderState = CulledChildren;
+    for (int i = done; i < nodes.size(); ++i)
+        nodes[i]->renderState = Render;
+    m_renderStateCounts[RenderChildren] -= (int) nodes.size() - done;
+    m_renderStateCounts[Render] += (int) nodes.size() - done;
+    if (done < nodes.size())
+        m_refinementPending = true;
+}
+
+void TreeMapLayouter::refineLayout()
+{
+    if (!m_refinementPending)
         return;
-    }
+
+    updateCulling();
+    updateChangedGroupRendering();
+    onViewportChanged();
+}
+
+void TreeMapLayouter::updateViewRects()
+{
+    for (Node *node : m_visibleNodes)
+        node->viewRect = sceneToView(node->sceneRect);
+}
+
+bool TreeMapLayouter::updateCullingState(Node &node, bool &fullyVisible)
+{
+    node.cullGeneration = m_cullGeneration;
 
     // cull against max. node depth
-    const int relativeDepth = treeNode.node->depth - m_renderedNode->depth;
+    const int relativeDepth = node.depth - m_renderedNode->depth;
     if (m_maxDepth > 0 && relativeDepth > m_maxDepth) {
-        treeNode.node->renderState = CulledDepth;
-        return;
+        node.renderState = CulledDepth;
+        ++m_renderStateCounts[CulledDepth];
+        if (node.groupRenderChildren)
+            markGroupDirty(node);
+        return false;
     }
 
     // cull against viewport, if necessary
     if (!fullyVisible) {
-        if (!m_viewport.intersects(treeNode.node->sceneRect)) {
-            treeNode.node->renderState = CulledViewport;
-            return;
+        if (!m_cullingRect.intersects(node.sceneRect)) {
+            node.renderState = CulledViewport;
+            ++m_renderStateCounts[CulledViewport];
+            if (node.groupRenderChildren)
+                markGroupDirty(node);
+            return false;
         }
-        if (m_viewport.contains(treeNode.node->sceneRect))
+        if (m_cullingRect.contains(node.sceneRect))
             fullyVisible = true;
     }
 
     // project rect into view space
-    const QRectF viewRect = sceneToView(treeNode.node->sceneRect);
-    treeNode.node->viewRect = viewRect;
+    const QRectF viewRect = sceneToView(node.sceneRect);
+    node.viewRect = viewRect;
+    m_visibleNodes << &node;
 
     // check whether we want to render the node directly, and
     // ignore the children it might have
     const bool tooSmall = viewRect.width() < m_maxSize || viewRect.height() < m_maxSize;
     const bool tooDeep = (m_maxDepth > 0 && relativeDepth >= m_maxDepth);
-    const bool tooUnparenty = treeNode.node->children.isEmpty();
+    const bool tooUnparenty = (layoutChildCount(node) == 0);
 
     if (tooSmall || tooDeep || tooUnparenty)
-        treeNode.node->renderState = Render;
+        node.renderState = Render;
     else
-        treeNode.node->renderState = RenderChildren;
+        node.renderState = RenderChildren;
+    ++m_renderStateCounts[node.renderState];
 
-    for (TreeNode::Subdivision &sub : treeNode.subdivisions) {
-        for (TreeNode &node : sub.subnodes) {
-            updateCulling(node, fullyVisible, treeNode.node->renderState == Render);
+    return true;
+}
+
+void TreeMapLayouter::updateGroupRendering()
+{
+    const float ratio = m_viewport.width() / m_width;
+    m_groupMinRatios.clear();
+    m_groupMaxRatios.clear();
+    for (Node *node : m_groupDirtyNodes)
+        node->groupDirty = false;
+    m_groupDirtyNodes.clear();
+
+    // nodes that aren't reached by this pass will be updated once they are visible again
+    ++m_groupGeneration;
+    updateGroupStates(*m_renderedNode, ratio, true);
+    m_groupRatio = ratio;
+    m_groupStatesValid = true;
+
+    collectGroupNodes();
+}
+
+void TreeMapLayouter::updateChangedGroupRendering()
+{
+    // stale index entries pile up with every update, until a full pass drops them
+    const int indexSize = m_groupMinRatios.size() + m_groupMaxRatios.size();
+    if (!m_groupStatesValid || indexSize > GROUP_INDEX_ENTRIES_PER_NODE * m_visibleNodes.size() + GROUP_INDEX_MIN_ENTRIES) {
+        updateGroupRendering();
+        return;
+    }
+
+    // zooming in lowers the ratio below the min. ratio of some nodes, zooming out
+    // raises it above the max. ratio of others
+    const float ratio = m_viewport.width() / m_width;
+    if (ratio < m_groupRatio) {
+        const auto first = m_groupMinRatios.upperBound(ratio);
+        for (auto it = first; it != m_groupMinRatios.end(); ++it) {
+            if (it.value()->groupMinRatio == it.key())
+                markGroupDirty(*it.value());
+        }
+        m_groupMinRatios.erase(first, m_groupMinRatios.end());
+    } else if (ratio > m_groupRatio) {
+        const auto last = m_groupMaxRatios.upperBound(ratio);
+        for (auto it = m_groupMaxRatios.begin(); it != last; ++it) {
+            if (it.value()->groupMaxRatio == it.key())
+                markGroupDirty(*it.value());
         }
+        m_groupMaxRatios.erase(m_groupMaxRatios.begin(), last);
     }
+    m_groupRatio = ratio;
+
+    // parents decide whether their children may be groups, so they go first
+    std::sort(m_groupDirtyNodes.begin(), m_groupDirtyNodes.end(), [](const Node *a, const Node *b) {
+        return a->depth < b->depth;
+    });
+    for (Node *node : m_groupDirtyNodes) {
+        if (node->groupDirty)
+            updateGroupStates(*node, ratio, false);
+    }
+    m_groupDirtyNodes.clear();
+
+    collectGroupNodes();
 }
 
-void TreeMapLayouter::updateGroupRendering(TreeNode *treeNode)
+void TreeMapLayouter::updateGroupStates(Node &node, float ratio, bool queueAllChildren)
 {
-    if (treeNode->node == nullptr)
-        return;
+    QVector<Node*> queue{&node};
+    while (!queue.isEmpty())
+        updateGroupState(*queue.takeLast(), ratio, queueAllChildren, queue);
+}
 
-    treeNode->node->groupViewRect = QRectF();
-    treeNode->node->groupLabelRect = QRectF();
+void TreeMapLayouter::updateGroupState(Node &node, float ratio, bool queueAllChildren, QVector<Node*> &queue)
+{
+    node.groupSceneRect = QRectF();
+    node.groupViewRect = QRectF();
+    node.groupLabelRect = QRectF();
+    node.groupDirty = false;
+    node.groupGeneration = m_groupGeneration;
+    node.groupRenderChildren = isVisited(node) && node.renderState == RenderChildren;
+    node.groupMinRatio = 0.0f;
+    node.groupMaxRatio = std::numeric_limits<float>::infinity();
 
     // if this node isn't rendering its children, exit early so we don't have to traverse the whole tree
-    if (treeNode != &m_treeRoot && treeNode->node->renderState != RenderChildren) {
-        treeNode->node->responsibleForGroup = false;
-        return;
+    if (&node != m_renderedNode) {
+        node.responsibleForGroup = node.groupRenderChildren && node.groupPermitted;
+        if (!node.groupRenderChildren)
+            return;
     }
 
     // we decided to render the node, now the question is whether it will be
-    // rendered as a group node or not
-    const float ratio = m_viewport.width() / m_width;
-    const float minSceneSize = m_minGroupSize * ratio;
-    const auto isPotentialGroup = [minSceneSize, ratio](Node &node, const QRectF &sceneRect) {
-        return sceneRect.width() > (node.groupLabelBounds.width() + 2.f * GROUP_LABEL_OFFSET) * ratio
-                && sceneRect.height() > (node.groupLabelBounds.height() + 2.f * GROUP_LABEL_OFFSET) * ratio
-                && sceneRect.width() > minSceneSize
-                && sceneRect.height() > minSceneSize;
+    // rendered as a group node or not. the thresholds were computed in scene
+    // space during layout, so this only compares against the zoom ratio.
+    const int subdivCount = isLaidOut(node) ? node.subdivisionCount : 0;
+    Subdivision *subdivs = m_subdivisions.data() + node.childOffset;
+
+    // the result stays the same while the ratio stays below the thresholds that
+    // were passed, and above the one that failed
+    bool canRenderSubdivsAsGroup = node.responsibleForGroup;
+    const auto check = [&](float threshold) {
+        if (ratio < threshold) {
+            node.groupMaxRatio = qMin(node.groupMaxRatio, threshold);
+        } else {
+            node.groupMinRatio = threshold;
+            canRenderSubdivsAsGroup = false;
+        }
     };
 
-    bool canRenderSubdivsAsGroup = treeNode->node->responsibleForGroup;
-    QVector<TreeNode::Subdivision> &subdivs = treeNode->subdivisions;
-    for (int i = 0 ; i < subdivs.size(); ++i) {
-        TreeNode::Subdivision &subdiv = subdivs[i];
-        subdiv.remainingViewRect = sceneToView(subdiv.remainingSceneRect);
+    for (int i = 0 ; i < subdivCount; ++i) {
+        const Subdivision &subdiv = subdivs[i];
 
         // check whether all sub-nodes on this level could be rendered as groups
-        for (TreeNode &node : subdiv.subnodes) {
-            canRenderSubdivsAsGroup &= isPotentialGroup(*node.node, node.node->sceneRect);
-        }
+        for (int j = 0; j < subdiv.nodeCount && canRenderSubdivsAsGroup; ++j)
+            check(groupThreshold(m_nodes[m_subdivisionNodes[subdiv.firstNode + j]], ratio));
 
         // check if the other subdivisions would still have enough space for
         // rendering their unified group label, if this subdiv would be
         // rendered as independent groups
-        if (i < subdivs.size() - 1 && !isPotentialGroup(*treeNode->node, subdivs[i + 1].remainingSceneRect)) {
-            canRenderSubdivsAsGroup = false;
-        }
+        if (canRenderSubdivsAsGroup && i < subdivCount - 1)
+            check(remainingGroupThreshold(node, subdivs[i + 1], ratio));
 
         // if, and only if so, we shall permit it, for all of them
-        for (TreeNode &node : subdiv.subnodes) {
-            node.node->responsibleForGroup = canRenderSubdivsAsGroup;
+        for (int j = 0; j < subdiv.nodeCount; ++j) {
+            Node &child = m_nodes[m_subdivisionNodes[subdiv.firstNode + j]];
+            const bool changed = (child.groupPermitted != canRenderSubdivsAsGroup);
+            child.groupPermitted = canRenderSubdivsAsGroup;
+            if (queueAllChildren || (changed && child.groupRenderChildren))
+                queue << &child;
         }
 
         // if this node is responsible for being rendered as a group,
         // but at least one sub-node within this subdivision is not eligible,
         // this means that we will have to draw the group on top of this node
         // (the group may possible only cover parts of it)
-        if (treeNode->node->groupViewRect.isNull()
-                && treeNode->node->responsibleForGroup
+        if (node.groupSceneRect.isNull()
+                && node.responsibleForGroup
                 && !canRenderSubdivsAsGroup) {
-            treeNode->node->groupViewRect = subdiv.remainingViewRect;
-            treeNode->node->groupLabelRect = treeNode->node->groupLabelBounds.translated(subdiv.remainingViewRect.topLeft());
-            treeNode->node->groupLabelRect.adjust(0, 0, 2 * GROUP_LABEL_OFFSET, 2 * GROUP_LABEL_OFFSET);
+            node.groupSceneRect = subdiv.remainingSceneRect;
         }
     }
 
-    // update children
-    for (TreeNode::Subdivision &subdiv : treeNode->subdivisions) {
-        for (TreeNode &node : subdiv.subnodes) {
-            updateGroupRendering(&node);
-        }
+    if (node.groupMinRatio > 0.0f)
+        m_groupMinRatios.insert(node.groupMinRatio, &node);
+    if (node.groupMaxRatio < std::numeric_limits<float>::infinity())
+        m_groupMaxRatios.insert(node.groupMaxRatio, &node);
+}
+
+void TreeMapLayouter::markGroupDirty(Node &node)
+{
+    if (!node.groupDirty) {
+        node.groupDirty = true;
+        m_groupDirtyNodes << &node;
+    }
+}
+
+void TreeMapLayouter::collectGroupNodes()
+{
+    // only nodes that render their children have a group rect, and all of them are visible
+    m_groupNodes.clear();
+    for (Node *node : m_visibleNodes) {
+        if (!node->groupSceneRect.isNull())
+            m_groupNodes << node;
+    }
+    updateGroupViewRects();
+}
+
+void TreeMapLayouter::updateGroupViewRects()
+{
+    for (Node *node : m_groupNodes) {
+        node->groupViewRect = sceneToView(node->groupSceneRect);
+        node->groupLabelRect = groupLabelBounds(*node).translated(node->groupViewRect.topLeft());
+        node->groupLabelRect.adjust(0, 0, 2 * GROUP_LABEL_OFFSET, 2 * GROUP_LABEL_OFFSET);
     }
 }
 
+const QRectF &TreeMapLayouter::groupLabelBounds(Node &node)
+{
+    if (!node.groupLabelMeasured) {
+        node.groupLabelBounds = QRectF(QPointF(0, 0), m_textMetrics.size(nodeGroupLabel(node)));
+        node.groupLabelMeasured = true;
+    }
+    return node.groupLabelBounds;
+}
+
+float TreeMapLayouter::groupRatioLimit(Node &node)
+{
+    if (node.groupRatioLimit < 0.0f)
+        node.groupRatioLimit = ratioLimit(node.sceneRect, groupLabelBounds(node));
+    return node.groupRatioLimit;
+}
+
+float TreeMapLayouter::remainingRatioLimit(Node &node, Subdivision &subdiv)
+{
+    if (subdiv.remainingRatioLimit < 0.0f)
+        subdiv.remainingRatioLimit = ratioLimit(subdiv.remainingSceneRect, groupLabelBounds(node));
+    return subdiv.remainingRatioLimit;
+}
+
+float TreeMapLayouter::groupThreshold(Node &node, float ratio)
+{
+    // labels are only measured for nodes that are large enough to become a group
+    const float sizeLimit = node.groupMinSide / m_minGroupSize;
+    return (sizeLimit <= ratio) ? sizeLimit : qMin(sizeLimit, groupRatioLimit(node));
+}
+
+float TreeMapLayouter::remainingGroupThreshold(Node &node, Subdivision &subdiv, float ratio)
+{
+    const float sizeLimit = subdiv.remainingMinSide / m_minGroupSize;
+    return (sizeLimit <= ratio) ? sizeLimit : qMin(sizeLimit, remainingRatioLimit(node, subdiv));
+}
+
 void TreeMapLayouter::setMaxDepth(int maxDepth)
 {
     if (m_maxDepth != maxDepth) {
         m_maxDepth = maxDepth;
-        updateCulling(m_treeRoot);
-        updateGroupRendering(&m_treeRoot);
+        updateCulling();
+        updateGroupRendering();
         onViewportChanged();
     }
 }
@@ -260,8 +801,8 @@ void TreeMapLayouter::setMaxSize(int maxSize)
     maxSize = qMin(maxSize, m_minGroupSize);
     if (m_maxSize != maxSize) {
         m_maxSize = maxSize;
-        updateCulling(m_treeRoot);
-        updateGroupRendering(&m_treeRoot);
+        updateCulling();
+        updateGroupRendering();
         onViewportChanged();
     }
 }
@@ -273,24 +814,18 @@ void TreeMapLayouter::setMinGroupSize(int minGroupSize)
         m_minGroupSize = minGroupSize;
         if (m_maxSize > minGroupSize) {
             m_maxSize = m_minGroupSize;
-            updateCulling(m_treeRoot);
+            updateCulling();
         }
-        updateGroupRendering(&m_treeRoot);
+        updateGroupRendering();
         onViewportChanged();
     }
 }
 
 void TreeMapLayouter::zoomIn(void *userData)
 {
-    if (Node *found = getNodeWithUserData(&m_root, userData)) {
+    if (Node *found = getNodeWithUserData(userData)) {
         m_zoomStack << found;
-        m_renderedNode = found;
-        relayoutTreeMapping(m_treeRoot, *m_renderedNode, m_viewport);
-        updateCulling(m_treeRoot);
-        updateGroupRendering(&m_treeRoot);
-
-        onLayoutChanged();
-        onViewportChanged();
+        setRenderedNode(found);
     }
 }
 
@@ -298,34 +833,73 @@ void TreeMapLayouter::zoomOut()
 {
     if (!m_zoomStack.isEmpty()) {
         m_zoomStack.removeLast();
-        m_renderedNode = m_zoomStack.empty() ? &m_root : m_zoomStack.last();
-        relayoutTreeMapping(m_treeRoot, *m_renderedNode, m_viewport);
-        updateCulling(m_treeRoot);
-        updateGroupRendering(&m_treeRoot);
-
-        onLayoutChanged();
-        onViewportChanged();
+        setRenderedNode(m_zoomStack.empty() ? &m_nodes[0] : m_zoomStack.last());
     }
 }
 
+bool TreeMapLayouter::zoomTo(void *userData)
+{
+    Node *found = getNodeWithUserData(userData);
+    if (!found)
+        return false;
+
+    // stack up all ancestors, so that zooming out walks back up to the root
+    m_zoomStack.clear();
+    for (Node *node = found; node->parent >= 0; node = &m_nodes[node->parent])
+        m_zoomStack.prepend(node);
+    setRenderedNode(found);
+    return true;
+}
+
+void TreeMapLayouter::setRenderedNode(Node *node)
+{
+    storeLayout();
+    m_renderedNode = node;
+    resetTreeMapping(m_viewport);
+    updateCulling();
+    updateGroupRendering();
+
+    onLayoutChanged();
+    onViewportChanged();
+}
+
 void TreeMapLayouter::resize(int width, int height)
 {
+    storeLayout();
     m_width = width;
     m_height = height;
     m_viewport = QRectF(0, 0, width, height);
-    relayoutTreeMapping(m_treeRoot, *m_renderedNode, m_viewport);
-    updateCulling(m_treeRoot);
-    updateGroupRendering(&m_treeRoot);
+    resetTreeMapping(m_viewport);
+    updateCulling();
+    updateGroupRendering();
 
     onLayoutChanged();
     onViewportChanged();
 }
 
+void TreeMapLayouter::forEachLaidOutChild(const Node &node, const std::function<void(const Node&)> &visitor) const
+{
+    if (!isLaidOut(node))
+        return;
+
+    for (int i = 0; i < node.subdivisionCount; ++i) {
+        const Subdivision &sub = m_subdivisions[node.childOffset + i];
+        for (int j = 0; j < sub.nodeCount; ++j)
+            visitor(m_nodes[m_subdivisionNodes[sub.firstNode + j]]);
+    }
+}
+
 void TreeMapLayouter::traverseRenderNodes(const TreeMapLayouter::Node &node, const TreeMapLayouter::NodeTraversalFunctor &visitor)
 {
-    if (visitor(node)) {
-        for (const Node &child : node.children)
-            traverseRenderNodes(child, visitor);
+    if (!isVisited(node))
+        return;
+
+    if (visitor(node) && isLaidOut(node)) {
+        for (int i = 0; i < node.subdivisionCount; ++i) {
+            const Subdivision &sub = m_subdivisions[node.childOffset + i];
+            for (int j = 0; j < sub.nodeCount; ++j)
+                traverseRenderNodes(m_nodes[m_subdivisionNodes[sub.firstNode + j]], visitor);
+        }
     }
 }
 
@@ -348,57 +922,157 @@ QPointF TreeMapLayouter::viewToScene(const QPointF &pt) const
     return QPointF(m_viewport.left() + pt.x() * scale, m_viewport.top() + pt.y() * scale);
 }
 
-void TreeMapLayouter::setViewport(const QRectF &rect)
+QRectF TreeMapLayouter::clampedViewport(const QRectF &rect) const
 {
-    m_viewport = rect;
-
-    if (m_viewport.width() > m_width)
-        m_viewport.setWidth(m_width);
-    if (m_viewport.height() > m_height)
-        m_viewport.setHeight(m_height);
-    if (m_viewport.left() < 0.0f)
-        m_viewport.moveLeft(0.0f);
-    if (m_viewport.top() < 0.0f)
-        m_viewport.moveTop(0.0f);
-    if (m_viewport.right() > m_width)
-        m_viewport.moveRight(m_width);
-    if (m_viewport.bottom() > m_height)
-        m_viewport.moveBottom(m_height);
+    QRectF viewport = rect;
+    if (viewport.width() > m_width)
+        viewport.setWidth(m_width);
+    if (viewport.height() > m_height)
+        viewport.setHeight(m_height);
+    if (viewport.left() < 0.0f)
+        viewport.moveLeft(0.0f);
+    if (viewport.top() < 0.0f)
+        viewport.moveTop(0.0f);
+    if (viewport.right() > m_width)
+        viewport.moveRight(m_width);
+    if (viewport.bottom() > m_height)
+        viewport.moveBottom(m_height);
+    return viewport;
+}
 
-    updateCulling(m_treeRoot);
-    updateGroupRendering(&m_treeRoot);
+void TreeMapLayouter::setViewport(const QRectF &rect)
+{
+    const QRectF previousViewport = m_viewport;
+    m_viewport = clampedViewport(rect);
+
+    // panning at the same zoom level within the culling rect neither changes
+    // which nodes are rendered, nor which of them are drawn as groups, only
+    // where they end up in view space
+    const bool sameZoom = m_viewport.size() == previousViewport.size();
+    if (m_cullingValid && !m_refinementPending && sameZoom && m_cullingRect.contains(m_viewport)) {
+        updateViewRects();
+        updateGroupViewRects();
+    } else {
+        updateCulling();
+        updateChangedGroupRendering();
+    }
 
     onViewportChanged();
 }
 
 const TreeMapLayouter::Node *TreeMapLayouter::getNodeAt(QPoint pt, const Node *parent) const
 {
-    if (parent->renderState == Render)
-        return parent->viewRect.contains(pt) ? parent : nullptr;
+    m_hitTestNodeCount = 0;
+    const QPointF scenePt = viewToScene(QPointF(pt));
 
-    if (parent->renderState == RenderChildren) {
-        if (!parent->viewRect.contains(pt))
+    while (parent) {
+        ++m_hitTestNodeCount;
+
+        if (!isVisited(*parent))
+            return nullptr;
+
+        if (parent->renderState == Render)
+            return parent->viewRect.contains(pt) ? parent : nullptr;
+
+        if (parent->renderState != RenderChildren || !parent->viewRect.contains(pt))
             return nullptr;
 
         if (!parent->groupLabelRect.isNull() && parent->groupLabelRect.contains(pt))
             return parent;
 
-        for (const Node &child : parent->children) {
-            if (const Node *found = getNodeAt(pt, &child))
-                return found;
-        }
+        parent = getChildAt(*parent, scenePt);
     }
 
     return nullptr;
 }
 
-TreeMapLayouter::Node *TreeMapLayouter::getNodeWithUserData(TreeMapLayouter::Node *node, void *data) const
+const TreeMapLayouter::Node *TreeMapLayouter::getChildAt(const Node &node, const QPointF &scenePt) const
+{
+    if (!isLaidOut(node) || node.subdivisionCount == 0)
+        return nullptr;
+
+    // the remaining rects are nested, so the point lies in the row of the last
+    // subdivision whose remaining rect still contains it
+    const Subdivision *subdivs = m_subdivisions.constData() + node.childOffset;
+    const Subdivision *subdivsEnd = subdivs + node.subdivisionCount;
+    const Subdivision *next = std::partition_point(subdivs, subdivsEnd, [&](const Subdivision &sub) {
+        return sub.remainingSceneRect.contains(scenePt);
+    });
+    if (next == subdivs)
+        return nullptr;
+    const Subdivision &sub = *(next - 1);
+    if (!sub.sceneRect.contains(scenePt))
+        return nullptr;
+
+    // the nodes within a row are placed next to each other along one axis, which
+    // squarify chose by the remaining rect: sceneRect may leave out the node's
+    // own size, and can thus have a different aspect ratio than the row
+    const int *first = m_subdivisionNodes.constData() + sub.firstNode;
+    const int *last = first + sub.nodeCount;
+    const bool vertical = sub.remainingSceneRect.width() >= sub.remainingSceneRect.height();
+    const int *found = std::partition_point(first, last, [&](int id) {
+        const QRectF &rect = m_nodes[id].sceneRect;
+        return vertical ? (rect.bottom() < scenePt.y()) : (rect.right() < scenePt.x());
+    });
+    if (found == last || !m_nodes[*found].sceneRect.contains(scenePt))
+        return nullptr;
+
+    return &m_nodes[*found];
+}
+
+int TreeMapLayouter::layoutChildCount(const Node &node) const
+{
+    return isBucket(node) ? node.bucketCount : m_provider->childCount(node.id);
+}
+
+float TreeMapLayouter::childMinScale(const Node &node) const
 {
-    if (node && node->userData == data)
-        return node;
-    for (Node &child : node->children) {
-        if (Node *found = getNodeWithUserData(&child, data))
-            return found;
+    const float side = minSide(node.sceneRect);
+    return (side > 0.0f) ? m_maxSize / side : std::numeric_limits<float>::infinity();
+}
+
+void TreeMapLayouter::labelScaleRange(const Node &node, const QSizeF &labelSize, float &minScale, float &maxScale) const
+{
+    const float w = node.sceneRect.width();
+    const float h = node.sceneRect.height();
+    if (w <= 0.0f || h <= 0.0f) {
+        minScale = maxScale = std::numeric_limits<float>::infinity();
+        return;
     }
-    return nullptr;
+
+    // the label is shown once the node is large enough to fit it...
+    const float textWidth = labelSize.width();
+    const float textHeight = labelSize.height();
+    minScale = qMax(qMax(10.0f / w, 5.0f / h), qMax((textWidth - 10.0f) / w, (textHeight - 5.0f) / h));
+
+    // ...until the node's children are rendered instead
+    const bool hasChildren = (layoutChildCount(node) > 0)
+            && (m_maxDepth <= 0 || node.depth - m_renderedNode->depth < m_maxDepth);
+    maxScale = hasChildren ? childMinScale(node) : std::numeric_limits<float>::infinity();
+}
+
+QColor TreeMapLayouter::nodeColor(const Node &node) const
+{
+    return m_provider->color(isBucket(node) ? node.parent : node.id);
+}
+
+QString TreeMapLayouter::nodeLabel(const Node &node) const
+{
+    return isBucket(node) ? QString("%1 more").arg(node.bucketCount) : m_provider->label(node.id);
+}
+
+QString TreeMapLayouter::nodeGroupLabel(const Node &node) const
+{
+    return m_provider->groupLabel(isBucket(node) ? node.parent : node.id);
+}
+
+void *TreeMapLayouter::nodeUserData(const Node &node) const
+{
+    return m_provider->userData(isBucket(node) ? node.parent : node.id);
+}
+
+TreeMapLayouter::Node *TreeMapLayouter::getNodeWithUserData(void *data)
+{
+    const auto it = m_userDataIndex.constFind(data);
+    return (it != m_userDataIndex.constEnd()) ? &m_nodes[it.value()] : nullptr;
 }
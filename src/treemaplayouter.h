@@ -1,26 +1,35 @@
 #pragma once
 
 #include "squarify.h"
+#include "treemapdataprovider.h"
+#include "textmetricscache.h"
 #include <QString>
 #include <QColor>
 #include <QRectF>
 #include <QVector>
+#include <QSharedPointer>
+#include <QHash>
+#include <QCache>
+#include <QMultiMap>
+#include <QFont>
+#include <QThreadPool>
 #include <functional>
 
-struct TreeMapNode
-{
-    QString label;
-    QString groupLabel;
-    QColor color;
-    float size = 0.0f;
-    QVector<TreeMapNode> children;
-    void *userData = nullptr;
-};
+class QElapsedTimer;
 
 class TreeMapLayouter
 {
 public:
-    void setRootNode(const TreeMapNode &root);
+    /**
+     * Per-node state derived from a data provider, independent of the viewport.
+     * Built by buildNodeTree(), which is safe to call from any thread, and then
+     * handed over to the layouter via setNodeTree().
+     */
+    struct NodeTree;
+    static QSharedPointer<NodeTree> buildNodeTree(const QSharedPointer<const TreeMapDataProvider> &provider, const QFont &font);
+
+    /** Takes over the nodes of the given tree and lays them out from the root */
+    void setNodeTree(const QSharedPointer<NodeTree> &tree);
 
     int maxDepth() const { return m_maxDepth; }
     void setMaxDepth(int maxDepth);
@@ -31,21 +40,48 @@ public:
     int minGroupSize() const { return m_minGroupSize; }
     void setMinGroupSize(int minGroupSize);
 
+    /** Number of label strings that had to be measured, i.e. text metric cache misses */
+    int textMeasureCount() const { return m_textMetrics.measureCount(); }
+
     void zoomIn(void *userData);
     void zoomOut();
 
+    /** Renders the node with the given user data, with all its ancestors on the zoom stack */
+    bool zoomTo(void *userData);
+
 protected:
     TreeMapLayouter(int width, int height);
     ~TreeMapLayouter();
 
-    virtual QRectF getTextBounds(const QString &text) const = 0;
     virtual void onNodeTreeChanged() = 0;
     virtual void onLayoutChanged() = 0;
     virtual void onViewportChanged() = 0;
 
     void resize(int width, int height);
     void setViewport(const QRectF &rect);
+
+    /** The part of rect that setViewport() would actually show, i.e. shrunk and moved into the scene */
+    QRectF clampedViewport(const QRectF &rect) const;
+
+    /**
+     * Limits the time a single culling pass spends laying out newly visible
+     * nodes, 0 meaning no limit. Nodes that don't fit into the budget are
+     * rendered in place of their children for now, and are laid out by the
+     * following calls to refineLayout().
+     */
+    void setLayoutTimeBudget(int msecs) { m_layoutTimeBudget = msecs; }
+    bool needsRefinement() const { return m_refinementPending; }
+    void refineLayout();
+
+    /** Threads laying out large batches of nodes, including the calling one */
+    int layoutThreadCount() const { return m_layoutPool.maxThreadCount() + 1; }
+    void setLayoutThreadCount(int threads) { m_layoutPool.setMaxThreadCount(qMax(0, threads - 1)); }
+
+    /** Time spent laying out batches of nodes since the layout was last discarded, without culling */
+    qint64 layoutNsecs() const { return m_layoutNsecs; }
+
     QRectF sceneToView(const QRectF &rect) const;
+    float viewScale() const { return m_width / m_viewport.width(); }
     QRectF viewToScene(const QRectF &rect) const;
     QPointF viewToScene(const QPointF &pt) const;
 
@@ -53,44 +89,117 @@ protected:
     {
         CulledViewport, // not visible because not in viewport
         CulledDepth,    // not visible because too deep
-        CulledChildren, // not visible because the parent is rendered
         Render,         // rendered
         RenderChildren  // not rendered, children are rendered instead
     };
 
+    /**
+     * Layout state of a single node. Labels, colors and sizes are not copied,
+     * but queried from m_provider using the node id.
+     */
     struct Node
     {
-        // data set by user
-        QString label;
-        QString groupLabel;
-        QRectF groupLabelBounds;
-        QColor color;
-        float size = 0.0f;
-        void *userData = nullptr;
+        // data set on tree rebuild
+        int id = 0;
+        int parent = -1;
         int depth = 0;
-        QVector<Node> children;
+        int childOffset = 0;
+        int bucket = -1;
+        QRectF groupLabelBounds; // only valid if groupLabelMeasured
+        bool groupLabelMeasured = false;
 
         // data updated on recalculate
         int treeDepth = 0;
         QRectF sceneRect;
+        int layoutGeneration = -1;
+        int subdivisionCount = 0;
+
+        // only set for buckets, which contain the tiny children of their parent
+        int bucketCount = 0;
+        float bucketSize = 0.0f;
 
-        // data updated on viewport change
+        // the node can be a group while the zoom ratio is below groupRatioLimit,
+        // and its smaller side exceeds the min. group size in scene space.
+        // groupRatioLimit is negative until the group label has been measured.
+        float groupRatioLimit = -1.0f;
+        float groupMinSide = 0.0f;
+
+        // data updated on viewport change, only valid if cullGeneration matches
+        // m_cullGeneration, otherwise the node hasn't been visited and is culled
         QRectF viewRect;
         NodeRenderState renderState = CulledViewport;
+        int cullGeneration = -1;
 
         bool responsibleForGroup = true;
+        bool groupPermitted = true; // as decided by the parent, see updateGroupState()
+        QRectF groupSceneRect;
         QRectF groupLabelRect;
         QRectF groupViewRect;
+
+        // the group state only has to be updated once the zoom ratio leaves
+        // [groupMinRatio, groupMaxRatio[, or the node's render state changes.
+        // it is only valid if groupGeneration matches m_groupGeneration.
+        int groupGeneration = -1;
+        bool groupRenderChildren = false;
+        bool groupDirty = false;
+        float groupMinRatio = 0.0f;
+        float groupMaxRatio = 0.0f;
     };
-    Node *m_renderedNode = &m_root;
+    QSharedPointer<const TreeMapDataProvider> m_provider;
+    Node *m_renderedNode = nullptr;
 
     using NodeTraversalFunctor = std::function<bool(const Node&)>;
     void traverseRenderNodes(const Node &node, const NodeTraversalFunctor &visitor);
 
+    /** Whether the node is drawn itself with the current viewport, rather than culled or split up */
+    bool isRendered(const Node &node) const { return isVisited(node) && node.renderState == Render; }
+
+    /** Number of nodes that the last culling pass visited and left in the given state */
+    int renderStateCount(NodeRenderState state) const { return m_renderStateCounts[state]; }
+
     /** Given the currently rendered tree, check which node is displayed at the given coords */
     const Node *getNodeAt(QPoint pt, const Node *parent) const;
 
-    Node *getNodeWithUserData(Node *node, void *data) const;
+    /** Number of nodes visited by the last call to getNodeAt() */
+    int hitTestNodeCount() const { return m_hitTestNodeCount; }
+
+    /** Looks up the first node in DFS order with the given user data */
+    Node *getNodeWithUserData(void *data);
+
+    /**
+     * Bucket nodes aggregate the children of a node that are too small to be
+     * visible, and are split back up once they are zoomed in on. They don't
+     * exist in m_provider, so their data has to be queried through these.
+     */
+    bool isBucket(const Node &node) const { return node.id >= m_provider->nodeCount(); }
+    QColor nodeColor(const Node &node) const;
+    QString nodeLabel(const Node &node) const;
+    QString nodeGroupLabel(const Node &node) const;
+    void *nodeUserData(const Node &node) const;
+
+    QSizeF textSize(const QString &text) { return m_textMetrics.size(text); }
+
+    /**
+     * All nodes whose children have been placed since the layout was last
+     * discarded, in the order in which they were laid out, i.e. every node
+     * comes after its ancestors. The layout generation changes whenever the
+     * list is cleared.
+     */
+    int layoutGeneration() const { return m_layoutGeneration; }
+    const QVector<Node*> &laidOutNodes() const { return m_laidOutNodes; }
+    void forEachLaidOutChild(const Node &node, const std::function<void(const Node&)> &visitor) const;
+
+    /** Number of children the node is split into once laid out, including its bucket */
+    int layoutChildCount(const Node &node) const;
+
+    /**
+     * Zoom scales at which laid out nodes and their labels are drawn, as
+     * decided by updateCullingState(). The children of a node are shown from
+     * childMinScale() on, and a label of the given size is shown on its node
+     * within [minScale, maxScale[, until the node is split up.
+     */
+    float childMinScale(const Node &node) const;
+    void labelScaleRange(const Node &node, const QSizeF &labelSize, float &minScale, float &maxScale) const;
 
     QRectF m_viewport;
 
@@ -102,27 +211,187 @@ private:
     int m_maxSize = 20;
     int m_minGroupSize = 50;
 
-    Node m_root;
+    /** indexed by node id */
+    QVector<Node> m_nodes;
     QVector<Node*> m_zoomStack;
+    QHash<void*, int> m_userDataIndex;
 
-    /** Corresponds to a squarified data node */
-    struct TreeNode
+    /**
+     * The squarified layout is stored in flat arrays: each node owns the slots
+     * [childOffset, childOffset + childCount[ in both m_subdivisions and
+     * m_subdivisionNodes, so that nodes can be laid out independently of
+     * each other. A node's subdivisions are only valid if its layoutGeneration
+     * matches m_layoutGeneration.
+     */
+    struct Subdivision
     {
-        struct Subdivision
+        /** rect of this subdivision and all that follow within this node */
+        QRectF remainingSceneRect;
+
+        /** bounds of the nodes in this subdivision only */
+        QRectF sceneRect;
+
+        /** group thresholds of the parent node within remainingSceneRect */
+        float remainingRatioLimit = -1.0f;
+        float remainingMinSide = 0.0f;
+
+        /** the ids of the nodes in this subdivision are [firstNode, firstNode + nodeCount[ in m_subdivisionNodes */
+        int firstNode = 0;
+        int nodeCount = 0;
+    };
+    QVector<Subdivision> m_subdivisions;
+    QVector<int> m_subdivisionNodes;
+    int m_layoutGeneration = 0;
+    QVector<Node*> m_laidOutNodes;
+
+    bool isLaidOut(const Node &node) const { return node.layoutGeneration == m_layoutGeneration; }
+
+    /** Children smaller than this are aggregated into their parent's bucket */
+    float m_bucketThreshold = 0.0f;
+
+    /**
+     * Culling only visits nodes that intersect the viewport, using the nested
+     * subdivision rects as a bounding volume hierarchy. Nodes that weren't
+     * visited keep their stale render state, and are identified by their
+     * cullGeneration.
+     *
+     * The culling rect is larger than the viewport, so that panning at the
+     * same zoom level can re-use the culling results and only needs to
+     * re-project the visited nodes into view space.
+     */
+    int m_cullGeneration = 0;
+    bool m_cullingValid = false;
+    QRectF m_cullingRect;
+    QVector<Node*> m_visibleNodes;
+
+    bool isVisited(const Node &node) const { return node.cullGeneration == m_cullGeneration; }
+    int m_renderStateCounts[RenderChildren + 1] = {};
+
+    int m_layoutTimeBudget = 0;
+    bool m_refinementPending = false;
+
+    /** Finds the laid out child containing the given point by bisecting the subdivisions */
+    const Node *getChildAt(const Node &node, const QPointF &scenePt) const;
+    mutable int m_hitTestNodeCount = 0;
+
+    /** Scratch buffers for relayoutTreeMapping(), re-used across nodes to avoid allocations */
+    struct LayoutBuffers
+    {
+        Squarify::Squarify squarify;
+        std::vector<float> sizes;
+        std::vector<int> childIds;
+        std::vector<Squarify::Row> rows;
+        std::vector<Squarify::Element> elements;
+    };
+    LayoutBuffers m_layoutBuffers;
+    QThreadPool m_layoutPool;
+    qint64 m_layoutNsecs = 0;
+
+    /**
+     * Layouts that were computed for previously rendered nodes. The layout of
+     * a subtree only depends on the rect its root was placed into, so moving
+     * back up the zoom stack or returning to a previous window size can copy
+     * the nodes' layout state back instead of squarifying again.
+     */
+    struct LayoutCacheKey
+    {
+        int nodeId;
+        QRectF rect;
+        float bucketThreshold;
+        bool operator==(const LayoutCacheKey &other) const
         {
-            /** rect of this subdivision and all that follow within this node */
-            QRectF remainingSceneRect;
-            QRectF remainingViewRect;
-            QVector<TreeNode> subnodes;
+            return nodeId == other.nodeId && rect == other.rect && bucketThreshold == other.bucketThreshold;
+        }
+    };
+    friend size_t qHash(const LayoutCacheKey &key, size_t seed)
+    {
+        return qHashMulti(seed, key.nodeId, key.rect.x(), key.rect.y(), key.rect.width(), key.rect.height(), key.bucketThreshold);
+    }
+    struct CachedLayout
+    {
+        struct NodeLayout
+        {
+            int id;
+            int treeDepth;
+            int subdivisionCount; // -1 if the node itself wasn't laid out
+            int childOffset;
+            int bucketCount;
+            float bucketSize;
+            QRectF sceneRect;
         };
-
-        Node *node = nullptr;
+        QVector<NodeLayout> nodes;
         QVector<Subdivision> subdivisions;
+        QVector<int> subdivisionNodes;
     };
-    TreeNode m_treeRoot;
+    QCache<LayoutCacheKey, CachedLayout> m_layoutCache;
+
+    /** Stores the current layout of m_renderedNode in m_layoutCache */
+    void storeLayout();
+
+    /** Restores the layout of m_renderedNode from m_layoutCache, if its rect matches */
+    bool restoreLayout();
+
+    static void rebuildNodeTree(NodeTree &tree, int id, int parent, int depth, int &childSlots);
+
+    /** Discards the current layout, and places m_renderedNode into the given rect */
+    void resetTreeMapping(const QRectF &rect);
+
+    /** Lays out the direct children of the given node, deeper levels are laid out on demand */
+    void relayoutTreeMapping(Node &node, LayoutBuffers &buffers);
+
+    /** Lays out the given nodes, spreading large batches across m_layoutPool */
+    void layoutNodes(QVector<Node*> &nodes);
+
+    /** Lays out the largest nodes until the budget is used up, which starts with the first call of a pass */
+    void layoutNodesWithinBudget(QVector<Node*> &nodes, QElapsedTimer &timer);
+
+    void setRenderedNode(Node *node);
+    void updateCulling();
+    void updateViewRects();
+    bool updateCullingState(Node &node, bool &fullyVisible);
+
+    /**
+     * Decides which of the rendered nodes are drawn as groups. The full pass
+     * visits the whole rendered tree, while updateChangedGroupRendering() only
+     * visits the nodes whose render state changed during the last culling pass,
+     * or whose group state isn't valid for the new zoom ratio anymore.
+     */
+    void updateGroupRendering();
+    void updateChangedGroupRendering();
+
+    /** Updates the group state of the node, and queues the children whose permission changed */
+    void updateGroupState(Node &node, float ratio, bool queueAllChildren, QVector<Node*> &queue);
+    void updateGroupStates(Node &node, float ratio, bool queueAllChildren);
+    void markGroupDirty(Node &node);
+
+    /**
+     * The group states are indexed by the bounds of their valid zoom ratios,
+     * so that a zoom change finds the affected nodes without visiting the
+     * others. Entries of nodes whose bounds changed since are skipped.
+     */
+    float m_groupRatio = 0.0f;
+    int m_groupGeneration = 0;
+    bool m_groupStatesValid = false;
+    QMultiMap<float, Node*> m_groupMinRatios;
+    QMultiMap<float, Node*> m_groupMaxRatios;
+    QVector<Node*> m_groupDirtyNodes;
+
+    /** Group labels are measured on first use, and their sizes are cached per string */
+    TextMetricsCache m_textMetrics;
+    const QRectF &groupLabelBounds(Node &node);
+    float groupRatioLimit(Node &node);
+    float remainingRatioLimit(Node &node, Subdivision &subdiv);
+
+    /**
+     * Zoom ratio below which the node, or the remaining subdivisions of a node,
+     * may be drawn as a group. Labels are only measured for nodes that are large
+     * enough at the given ratio, otherwise an upper bound below it is returned.
+     */
+    float groupThreshold(Node &node, float ratio);
+    float remainingGroupThreshold(Node &node, Subdivision &subdiv, float ratio);
+    void collectGroupNodes();
+    void updateGroupViewRects();
 
-    void rebuildNodeTree(Node &dstNode, const TreeMapNode &srcNode, int depth);
-    static void relayoutTreeMapping(TreeNode &treeNode, Node &node, const QRectF &rect);
-    void updateCulling(TreeNode &treeNode, bool fullyVisible = false, bool culledParent = false);
-    void updateGroupRendering(TreeNode *treeNode);
+    /** Nodes with a group rect, as found by the last group update */
+    QVector<Node*> m_groupNodes;
 };
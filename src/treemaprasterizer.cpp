@@ -0,0 +1,323 @@
+#include "treemaprasterizer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+#include <QtMath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** Number of image rows that are filled by one thread at a time */
+static constexpr int BAND_HEIGHT = 32;
+
+/**
+ * How much of a rect's color shows at the given relative position along one
+ * axis, which is the separable part of the fragment shader's cushion shading
+ */
+static float cushionProfile(float uv, float border)
+{
+    const float d = qAbs(uv - 0.5f);
+    const float f = std::pow(qMax(0.0f, 1.0f - 2.0f * d), border);
+
+    // smoothstep(-0.5, 1.0, f)
+    const float t = qBound(0.0f, (f + 0.5f) / 1.5f, 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+/**
+ * Number of pixels whose centers are below the given coordinate, like GL's
+ * coverage rule, clamped before the conversion, as culled rects can be far off
+ */
+static int pixelEdge(float coord, int size)
+{
+    return (int) qBound(0.0f, std::ceil(coord - 0.5f), (float) size);
+}
+
+/** Fills a span of an opaque rect, which is faded to black towards its borders */
+static void fillOpaqueSpan(QRgb *dst, const float *profile, int count, float r, float g, float b)
+{
+    int i = 0;
+#ifdef __SSE2__
+    const __m128 vr = _mm_set1_ps(r);
+    const __m128 vg = _mm_set1_ps(g);
+    const __m128 vb = _mm_set1_ps(b);
+    const __m128i alpha = _mm_set1_epi32((int) 0xff000000);
+    for (; i + 4 <= count; i += 4) {
+        const __m128 t = _mm_loadu_ps(profile + i);
+        const __m128i ir = _mm_cvtps_epi32(_mm_mul_ps(vr, t));
+        const __m128i ig = _mm_cvtps_epi32(_mm_mul_ps(vg, t));
+        const __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(vb, t));
+        const __m128i rg = _mm_or_si128(_mm_slli_epi32(ir, 16), _mm_slli_epi32(ig, 8));
+        _mm_storeu_si128((__m128i*) (dst + i), _mm_or_si128(_mm_or_si128(alpha, rg), ib));
+    }
+#endif
+    for (; i < count; ++i) {
+        const float t = profile[i];
+        dst[i] = qRgb(qRound(r * t), qRound(g * t), qRound(b * t));
+    }
+}
+
+/** Blends a span of a translucent rect, with the same blend function as the GL path */
+static void blendSpan(QRgb *dst, const float *profile, int count, float r, float g, float b, float a, float ty)
+{
+    for (int i = 0; i < count; ++i) {
+        const float t = profile[i] * ty;
+        const float alpha = 1.0f + (a - 1.0f) * t;
+        const float inv = 1.0f - alpha;
+        const QRgb d = dst[i];
+        dst[i] = qRgb(qRound(r * t * alpha + qRed(d) * inv),
+                      qRound(g * t * alpha + qGreen(d) * inv),
+                      qRound(b * t * alpha + qBlue(d) * inv));
+    }
+}
+
+/**
+ * Sorts the candidates into the bands they overlap, keeping their order, so
+ * that band b draws items[offsets[b]] until items[offsets[b + 1]]. The range
+ * function returns false for items that aren't visible at all.
+ */
+template <class BandRange>
+static void binByBand(const QVector<int> &candidates, int bands, const BandRange &bandRange, QVector<int> &offsets, QVector<int> &items)
+{
+    offsets.fill(0, bands + 1);
+    int first, last;
+    for (const int idx : candidates) {
+        if (bandRange(idx, first, last)) {
+            for (int b = first; b <= last; ++b)
+                ++offsets[b + 1];
+        }
+    }
+    for (int b = 0; b < bands; ++b)
+        offsets[b + 1] += offsets[b];
+
+    // offsets[b] is used as the fill cursor of band b, which ends up at the start of band b + 1
+    items.resize(offsets[bands]);
+    for (const int idx : candidates) {
+        if (bandRange(idx, first, last)) {
+            for (int b = first; b <= last; ++b)
+                items[offsets[b]++] = idx;
+        }
+    }
+    for (int b = bands; b > 0; --b)
+        offsets[b] = offsets[b - 1];
+    offsets[0] = 0;
+}
+
+/** Turns the rows covered by [y0, y1[ into the range of bands they overlap */
+static bool rowsToBands(float y0, float y1, int height, int &first, int &last)
+{
+    const int py0 = pixelEdge(y0, height);
+    const int py1 = pixelEdge(y1, height);
+    if (py0 >= py1)
+        return false;
+    first = py0 / BAND_HEIGHT;
+    last = (py1 - 1) / BAND_HEIGHT;
+    return true;
+}
+
+TreeMapRasterizer::TreeMapRasterizer()
+{
+}
+
+void TreeMapRasterizer::clear()
+{
+    m_nodes.clear();
+    m_chunks.clear();
+    m_labels.clear();
+}
+
+void TreeMapRasterizer::addNodes(const NodeInstance *nodes, const float *minScales, int count)
+{
+    if (count <= 0)
+        return;
+
+    Chunk chunk;
+    chunk.first = m_nodes.size();
+    chunk.minScales.resize(count);
+    m_nodes.reserve(m_nodes.size() + count);
+    for (int i = 0; i < count; ++i) {
+        m_nodes << nodes[i];
+        chunk.minScales[i] = minScales[i];
+    }
+    m_chunks << chunk;
+}
+
+void TreeMapRasterizer::addLabels(const GlyphInstance *glyphs, int count)
+{
+    m_labels.reserve(m_labels.size() + count);
+    for (int i = 0; i < count; ++i)
+        m_labels << glyphs[i];
+}
+
+void TreeMapRasterizer::setGlyphAtlas(const QImage &atlas)
+{
+    m_atlas = atlas.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+void TreeMapRasterizer::render(QImage &image, const Frame &frame)
+{
+    Q_ASSERT(image.format() == QImage::Format_RGB32);
+    if (image.isNull() || frame.screenSize.isEmpty() || frame.viewport.isEmpty())
+        return;
+
+    const QPointF sceneOffset = -frame.viewport.topLeft();
+    const float sceneScale = frame.screenSize.width() / frame.viewport.width();
+    const float scaleX = (float) image.width() / frame.screenSize.width();
+    const float scaleY = (float) image.height() / frame.screenSize.height();
+    const int bands = (image.height() + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+    // the current zoom level decides how much of each chunk is visible
+    m_candidates.clear();
+    for (const Chunk &chunk : m_chunks) {
+        const int count = std::upper_bound(chunk.minScales.cbegin(), chunk.minScales.cend(), frame.lodScale) - chunk.minScales.cbegin();
+        for (int i = 0; i < count; ++i)
+            m_candidates << chunk.first + i;
+    }
+
+    // instances are binned by the bands they overlap once, instead of every
+    // band testing all of them, with the same pixel coverage as fillRect()
+    binByBand(m_candidates, bands, [&](int idx, int &first, int &last) {
+        const NodeInstance &rect = m_nodes.at(idx);
+        const float x0 = (rect.x + sceneOffset.x()) * sceneScale * scaleX;
+        const float x1 = (rect.x + rect.w + sceneOffset.x()) * sceneScale * scaleX;
+        if (pixelEdge(x0, image.width()) >= pixelEdge(x1, image.width()))
+            return false;
+        const float y0 = (rect.y + sceneOffset.y()) * sceneScale * scaleY;
+        const float y1 = (rect.y + rect.h + sceneOffset.y()) * sceneScale * scaleY;
+        return rowsToBands(y0, y1, image.height(), first, last);
+    }, m_nodeBandOffsets, m_nodeBands);
+
+    m_candidates.clear();
+    for (int i = 0; i < m_labels.size(); ++i) {
+        if (frame.lodScale >= m_labels[i].minScale && frame.lodScale < m_labels[i].maxScale)
+            m_candidates << i;
+    }
+    binByBand(m_candidates, bands, [&](int idx, int &first, int &last) {
+        const GlyphInstance &glyph = m_labels.at(idx);
+        const float oy = std::floor((glyph.anchorY + sceneOffset.y()) * sceneScale + 0.5f) + glyph.y;
+        return rowsToBands(oy * scaleY, (oy + glyph.h) * scaleY, image.height(), first, last);
+    }, m_labelBandOffsets, m_labelBands);
+
+    // the bands are rendered concurrently, so only access the instances through const references
+    const QVector<NodeInstance> &nodes = m_nodes;
+    const QVector<GlyphInstance> &labels = m_labels;
+    const QVector<int> &nodeOffsets = m_nodeBandOffsets;
+    const QVector<int> &nodeBands = m_nodeBands;
+    const QVector<int> &labelOffsets = m_labelBandOffsets;
+    const QVector<int> &labelBands = m_labelBands;
+
+    // same order as in TreeMapWidget::renderScene(), every band draws everything that overlaps it
+    const auto renderBand = [&](Band &band, int idx) {
+        for (int y = band.top; y < band.bottom; ++y)
+            std::fill_n((QRgb*) (band.bits + y * band.bytesPerLine), band.width, qRgb(0, 0, 0));
+
+        for (int i = nodeOffsets.at(idx); i < nodeOffsets.at(idx + 1); ++i)
+            fillRect(band, nodes.at(nodeBands.at(i)), sceneOffset, sceneScale, 0.3f);
+        for (int i = labelOffsets.at(idx); i < labelOffsets.at(idx + 1); ++i)
+            drawGlyph(band, labels.at(labelBands.at(i)), sceneOffset, sceneScale, qRgb(0, 0, 0));
+
+        for (int i = 0; i < frame.groupCount; ++i)
+            fillRect(band, frame.groups[i], frame.viewOffset, 1.0f, 0.6f);
+        for (int i = 0; i < frame.groupLabelCount; ++i)
+            drawGlyph(band, frame.groupLabels[i], frame.viewOffset, 1.0f, qRgb(255, 255, 255));
+    };
+
+    uchar *bits = image.bits();
+    std::atomic<int> counter(0);
+    const auto work = [&]() {
+        Band band;
+        band.bits = bits;
+        band.bytesPerLine = image.bytesPerLine();
+        band.width = image.width();
+        band.scaleX = scaleX;
+        band.scaleY = scaleY;
+        for (int idx = counter.fetch_add(1); idx < bands; idx = counter.fetch_add(1)) {
+            band.top = idx * BAND_HEIGHT;
+            band.bottom = qMin(band.top + BAND_HEIGHT, image.height());
+            renderBand(band, idx);
+        }
+    };
+
+    const int tasks = qMin(m_pool.maxThreadCount(), bands - 1);
+    for (int i = 0; i < tasks; ++i)
+        m_pool.start(work);
+    work();
+    m_pool.waitForDone();
+}
+
+void TreeMapRasterizer::fillRect(Band &band, const NodeInstance &rect, QPointF offset, float scale, float border)
+{
+    // same transformation as the vertex shader, followed by the stretch into the image
+    const float x0 = (rect.x + offset.x()) * scale * band.scaleX;
+    const float x1 = (rect.x + rect.w + offset.x()) * scale * band.scaleX;
+    const float y0 = (rect.y + offset.y()) * scale * band.scaleY;
+    const float y1 = (rect.y + rect.h + offset.y()) * scale * band.scaleY;
+
+    // like GL, only cover the pixels whose centers are inside the rect
+    const int px0 = pixelEdge(x0, band.width);
+    const int px1 = pixelEdge(x1, band.width);
+    const int py0 = qMax(band.top, pixelEdge(y0, band.bottom));
+    const int py1 = pixelEdge(y1, band.bottom);
+    if (px0 >= px1 || py0 >= py1)
+        return;
+
+    const int count = px1 - px0;
+    band.profile.resize(count);
+    float *profile = band.profile.data();
+    const float invWidth = 1.0f / (x1 - x0);
+    for (int i = 0; i < count; ++i)
+        profile[i] = cushionProfile((px0 + i + 0.5f - x0) * invWidth, border);
+
+    const bool opaque = (rect.a == 255);
+    const float invHeight = 1.0f / (y1 - y0);
+    for (int y = py0; y < py1; ++y) {
+        const float ty = cushionProfile((y + 0.5f - y0) * invHeight, border);
+        QRgb *line = (QRgb*) (band.bits + y * band.bytesPerLine) + px0;
+        if (opaque)
+            fillOpaqueSpan(line, profile, count, rect.r * ty, rect.g * ty, rect.b * ty);
+        else
+            blendSpan(line, profile, count, rect.r, rect.g, rect.b, rect.a / 255.0f, ty);
+    }
+}
+
+void TreeMapRasterizer::drawGlyph(Band &band, const GlyphInstance &glyph, QPointF offset, float scale, QRgb color)
+{
+    if (m_atlas.isNull())
+        return;
+
+    // same as the text vertex shader, the anchor is snapped to whole pixels in view space
+    const float ox = std::floor((glyph.anchorX + offset.x()) * scale + 0.5f) + glyph.x;
+    const float oy = std::floor((glyph.anchorY + offset.y()) * scale + 0.5f) + glyph.y;
+
+    const int px0 = pixelEdge(ox * band.scaleX, band.width);
+    const int px1 = pixelEdge((ox + glyph.w) * band.scaleX, band.width);
+    const int py0 = qMax(band.top, pixelEdge(oy * band.scaleY, band.bottom));
+    const int py1 = pixelEdge((oy + glyph.h) * band.scaleY, band.bottom);
+
+    for (int y = py0; y < py1; ++y) {
+        const int ty = glyph.atlasY + (int) std::floor((y + 0.5f) / band.scaleY - oy);
+        if (ty < 0 || ty >= m_atlas.height())
+            continue;
+        const QRgb *src = (const QRgb*) m_atlas.constScanLine(ty);
+        QRgb *line = (QRgb*) (band.bits + y * band.bytesPerLine);
+
+        for (int x = px0; x < px1; ++x) {
+            const int tx = glyph.atlasX + (int) std::floor((x + 0.5f) / band.scaleX - ox);
+            if (tx < 0 || tx >= m_atlas.width())
+                continue;
+            const int coverage = qAlpha(src[tx]);
+            if (coverage == 0)
+                continue;
+
+            const float a = coverage / 255.0f;
+            const float inv = 1.0f - a;
+            const QRgb d = line[x];
+            line[x] = qRgb(qRound(qRed(color) * a + qRed(d) * inv),
+                           qRound(qGreen(color) * a + qGreen(d) * inv),
+                           qRound(qBlue(color) * a + qBlue(d) * inv));
+        }
+    }
+}
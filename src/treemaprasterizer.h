@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QImage>
+#include <QPointF>
+#include <QRectF>
+#include <QSize>
+#include <QThreadPool>
+#include <QVector>
+
+#include "treemapinstance.h"
+
+/**
+ * Renders the same instances that TreeMapWidget uploads to the GPU into a
+ * QImage instead, for hosts without a GPU or with slow GL emulation. Rects
+ * are cushion-shaded with the fragment shader's formula, and labels are
+ * copied from the same glyph atlas, so both paths produce the same image.
+ *
+ * The image is split into bands of rows, which are filled in parallel. The
+ * visible instances are sorted into the bands they overlap once per render,
+ * so each band only visits its own. The cushion shading is separable, so
+ * filling a rect only blends a column profile, computed once per rect, into
+ * each of its rows.
+ */
+class TreeMapRasterizer
+{
+public:
+    TreeMapRasterizer();
+
+    /** Drops all node and label instances */
+    void clear();
+
+    /** Adds a chunk of node instances, sorted by the zoom scale from which on they are visible */
+    void addNodes(const NodeInstance *nodes, const float *minScales, int count);
+    void addLabels(const GlyphInstance *glyphs, int count);
+    void setGlyphAtlas(const QImage &atlas);
+
+    /** Everything that changes from frame to frame */
+    struct Frame
+    {
+        QSize screenSize; // view space size, which is stretched to the image size
+        QRectF viewport;
+        float lodScale = 1.0f;
+
+        // group outlines and labels are already in view space, and are only
+        // moved by the offset, e.g. to render a tile of a larger view
+        QPointF viewOffset;
+        const NodeInstance *groups = nullptr;
+        int groupCount = 0;
+        const GlyphInstance *groupLabels = nullptr;
+        int groupLabelCount = 0;
+    };
+
+    /** Renders into the given image, which has to be in QImage::Format_RGB32 */
+    void render(QImage &image, const Frame &frame);
+
+private:
+    struct Chunk
+    {
+        int first = 0;
+        QVector<float> minScales;
+    };
+    QVector<NodeInstance> m_nodes;
+    QVector<Chunk> m_chunks;
+    QVector<GlyphInstance> m_labels;
+    QImage m_atlas;
+
+    // scratch memory of render(), the visible instances of each band
+    QVector<int> m_candidates;
+    QVector<int> m_nodeBandOffsets;
+    QVector<int> m_nodeBands;
+    QVector<int> m_labelBandOffsets;
+    QVector<int> m_labelBands;
+
+    /** Rows [top, bottom[ of the image, and the stretch from view space into it */
+    struct Band
+    {
+        uchar *bits = nullptr;
+        qsizetype bytesPerLine = 0;
+        int width = 0;
+        int top = 0;
+        int bottom = 0;
+        float scaleX = 1.0f;
+        float scaleY = 1.0f;
+        QVector<float> profile; // scratch memory of fillRect()
+    };
+    void fillRect(Band &band, const NodeInstance &rect, QPointF offset, float scale, float border);
+    void drawGlyph(Band &band, const GlyphInstance &glyph, QPointF offset, float scale, QRgb color);
+
+    QThreadPool m_pool;
+};
@@ -2,58 +2,139 @@
 
 #include <memory>
 #include <algorithm>
+#include <limits>
+#include <numeric>
 
 #include "squarify.h"
+#include "treemapbuffer.h"
+#include "treemaprasterizer.h"
 
 #include <QtMath>
 #include <QPaintEvent>
 #include <QWheelEvent>
 #include <QMouseEvent>
 #include <QPainter>
+#include <QToolTip>
 #include <QDebug>
 #include <QScopedArrayPointer>
-#include <QFontMetrics>
+#include <QMatrix4x4>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QFontDatabase>
 
 #include <QOpenGLContext>
 #include <QOpenGLFunctions>
 #include <QOpenGLExtraFunctions>
 
-using SquarifyNode = Squarify::TreeMapNode;
-using Squarify::Rect;
-
 const char *s_vs = "\
     attribute vec2 pos; \
-    attribute vec4 rect; \
+    attribute vec2 rectPos; \
+    attribute vec2 rectSize; \
     attribute vec4 bgColor; \
-    attribute vec4 fadeColor; \
     uniform vec2 screenSize; \
     uniform vec2 offset; \
     uniform float scale; \
     varying vec4 v_bgColor; \
-    varying vec4 v_fadeColor; \
     varying vec2 v_uv; \
     void main() { \
         v_bgColor = bgColor; \
-        v_fadeColor = fadeColor; \
         v_uv = pos; \
-        vec2 viewPos = (rect.xy + pos * rect.zw + offset) * scale; \
+        vec2 viewPos = (rectPos + pos * rectSize + offset) * scale; \
         gl_Position = vec4(vec2(-1.0, 1.0) + vec2(2.0, -2.0) * viewPos / screenSize, 0.0, 1.0); \
     }\
 ";
 
 const char *s_fs = "\
     uniform float border; \
+    uniform vec4 fadeColor; \
     varying vec4 v_bgColor; \
-    varying vec4 v_fadeColor; \
     varying vec2 v_uv; \
     void main() { \
         vec2 d = abs(v_uv - vec2(0.5)); \
         vec2 f = pow(vec2(1.0) - 2.0 * d, vec2(border)); \
         vec2 v = smoothstep(vec2(-0.5), vec2(1.0), f); \
-        gl_FragColor = vec4(mix(v_fadeColor, v_bgColor, v.x * v.y)); \
+        gl_FragColor = vec4(mix(fadeColor, v_bgColor, v.x * v.y)); \
+    }\
+";
+
+const char *s_textVs = "\
+    attribute vec2 pos; \
+    attribute vec2 anchor; \
+    attribute vec4 glyph; \
+    attribute vec2 uv; \
+    attribute vec2 lod; \
+    uniform vec2 screenSize; \
+    uniform vec2 offset; \
+    uniform float scale; \
+    uniform float lodScale; \
+    uniform vec2 atlasSize; \
+    varying vec2 v_uv; \
+    void main() { \
+        v_uv = (uv + pos * glyph.zw) / atlasSize; \
+        vec2 viewPos = floor((anchor + offset) * scale + 0.5) + glyph.xy + pos * glyph.zw; \
+        bool visible = (lodScale >= lod.x) && (lodScale < lod.y); \
+        gl_Position = visible ? vec4(vec2(-1.0, 1.0) + vec2(2.0, -2.0) * viewPos / screenSize, 0.0, 1.0) : vec4(2.0, 2.0, 2.0, 1.0); \
+    }\
+";
+
+const char *s_textFs = "\
+    uniform sampler2D atlas; \
+    uniform vec4 textColor; \
+    varying vec2 v_uv; \
+    void main() { \
+        gl_FragColor = vec4(textColor.rgb, textColor.a * texture2D(atlas, v_uv).a); \
     }\
 ";
 
+/** The instance buffer is rebuilt once it has been extended this many times */
+static constexpr int MAX_INSTANCE_CHUNKS = 8;
+static constexpr int MIN_INSTANCE_CAPACITY = 4096;
+
+/** Time the layouter may spend on laying out newly visible nodes per frame, in ms */
+static constexpr int LAYOUT_TIME_BUDGET = 8;
+
+/**
+ * Everything paintGL() needs from the layouter to draw one frame. The render
+ * worker fills in a list, and hands it over once it is complete. Lists are
+ * re-used, so their buffers only allocate while growing.
+ */
+struct TreeMapWidget::RenderList
+{
+    QRectF viewport;
+    float lodScale = 1.0f;
+
+    // node instances and labels that were laid out since the previous list,
+    // which replace all previous instances if rebuild is set
+    bool rebuild = false;
+    int instanceCapacity = 0;
+    int labelCapacity = 0;
+    int labelFirst = 0;
+    InstanceChunk chunk;
+    VertexBuffer nodes;
+    LabelBuffer labels;
+
+    // groups depend on the viewport, and are re-built for every list
+    VertexBuffer groups;
+    LabelBuffer groupLabels;
+
+    // a copy of the glyph atlas, if glyphs were added for this list
+    QImage glyphAtlas;
+
+    // the whole scene, if it was rasterized on the CPU
+    bool software = false;
+    QImage image;
+
+    qint64 allocatedBytes = 0;
+
+    // measured by the render worker, see addRenderListStats()
+    double cullMsecs = 0.0;
+    double instanceMsecs = 0.0;
+    double groupMsecs = 0.0;
+    double rasterizeMsecs = 0.0;
+    int renderStateCounts[RenderChildren + 1] = {};
+    int textMeasures = 0;
+};
+
 TreeMapWidget::TreeMapWidget(QWidget *parent)
     : QOpenGLWidget(parent)
     , TreeMapLayouter(width(), height())
@@ -61,7 +142,19 @@ TreeMapWidget::TreeMapWidget(QWidget *parent)
     , m_quadVertexBuffer(QOpenGLBuffer::VertexBuffer)
     , m_nodeInstanceBuffer(QOpenGLBuffer::VertexBuffer)
     , m_groupInstanceBuffer(QOpenGLBuffer::VertexBuffer)
+    , m_labelInstanceBuffer(QOpenGLBuffer::VertexBuffer)
+    , m_groupLabelBuffer(QOpenGLBuffer::VertexBuffer)
+    , m_workerList(new RenderList())
+    , m_completedList(new RenderList())
+    , m_drawList(new RenderList())
+    , m_nodeStaging(new VertexBuffer())
 {
+    m_renderWorker.setMaxThreadCount(1);
+    setLayoutTimeBudget(LAYOUT_TIME_BUDGET);
+    m_softwareRendering = qEnvironmentVariableIsSet("LOCVIEW_SOFTWARE_RENDERING");
+    m_frameStatsVisible = qEnvironmentVariableIsSet("LOCVIEW_FRAME_STATS");
+    m_targetViewport = m_viewport;
+
     setMouseTracking(true);
     connect(&m_resizeTimer, &QTimer::timeout, this, &TreeMapWidget::onResize);
     m_resizeTimer.setSingleShot(true);
@@ -69,6 +162,19 @@ TreeMapWidget::TreeMapWidget(QWidget *parent)
 
 TreeMapWidget::~TreeMapWidget()
 {
+    m_renderWorker.waitForDone();
+
+    // the atlas texture has to be destroyed while its context is current
+    makeCurrent();
+    m_glyphTexture.reset();
+    m_softwareTexture.reset();
+    m_sceneFbo.reset();
+#if !QT_CONFIG(opengles2)
+    m_sceneTimer.reset();
+#endif
+    if (m_sceneBlitter.isCreated())
+        m_sceneBlitter.destroy();
+    doneCurrent();
 }
 
 void TreeMapWidget::resizeEvent(QResizeEvent *event)
@@ -82,8 +188,72 @@ void TreeMapWidget::resizeEvent(QResizeEvent *event)
 
 void TreeMapWidget::onResize()
 {
-    m_oldSize = QSize(width(), height());
-    TreeMapLayouter::resize(width(), height());
+    withLayout([this]() {
+        m_oldSize = QSize(width(), height());
+        TreeMapLayouter::resize(width(), height());
+    });
+}
+
+void TreeMapWidget::setNodeTree(const QSharedPointer<NodeTree> &tree)
+{
+    withLayout([this, tree]() { TreeMapLayouter::setNodeTree(tree); });
+}
+
+void TreeMapWidget::setMaxDepth(int maxDepth)
+{
+    withLayout([this, maxDepth]() { TreeMapLayouter::setMaxDepth(maxDepth); }, [this]() { onSettingsApplied(); });
+}
+
+void TreeMapWidget::setMaxSize(int maxSize)
+{
+    withLayout([this, maxSize]() { TreeMapLayouter::setMaxSize(maxSize); }, [this]() { onSettingsApplied(); });
+}
+
+void TreeMapWidget::setMinGroupSize(int minGroupSize)
+{
+    withLayout([this, minGroupSize]() { TreeMapLayouter::setMinGroupSize(minGroupSize); }, [this]() { onSettingsApplied(); });
+}
+
+void TreeMapWidget::zoomIn(void *userData)
+{
+    withLayout([this, userData]() { TreeMapLayouter::zoomIn(userData); });
+}
+
+void TreeMapWidget::zoomOut()
+{
+    withLayout([this]() { TreeMapLayouter::zoomOut(); });
+}
+
+void TreeMapWidget::zoomTo(void *userData)
+{
+    withLayout([this, userData]() { TreeMapLayouter::zoomTo(userData); });
+}
+
+void TreeMapWidget::onSettingsApplied()
+{
+    // the layouter clamps settings against each other, so only report the final state
+    if (m_deferredActions.isEmpty())
+        emit settingsChanged();
+}
+
+void TreeMapWidget::withLayout(const std::function<void()> &action, const std::function<void()> &done)
+{
+    m_deferredActions << DeferredAction{action, done};
+    runDeferredActions();
+}
+
+void TreeMapWidget::runDeferredActions()
+{
+    // the worker may take the layout again in between, which leaves the rest for its next hand-over
+    while (!m_deferredActions.isEmpty()) {
+        if (!m_layoutMutex.tryLock())
+            return;
+        const DeferredAction deferred = m_deferredActions.takeFirst();
+        deferred.action();
+        m_layoutMutex.unlock();
+        if (deferred.done)
+            deferred.done();
+    }
 }
 
 void TreeMapWidget::initializeGL()
@@ -94,9 +264,20 @@ void TreeMapWidget::initializeGL()
         qWarning() << m_shader.log();
     }
     m_shaderLocPos = m_shader.attributeLocation("pos");
-    m_shaderLocRect = m_shader.attributeLocation("rect");
+    m_shaderLocRectPos = m_shader.attributeLocation("rectPos");
+    m_shaderLocRectSize = m_shader.attributeLocation("rectSize");
     m_shaderLocBgColor = m_shader.attributeLocation("bgColor");
-    m_shaderLocFadeColor = m_shader.attributeLocation("fadeColor");
+
+    if (!m_textShader.addShaderFromSourceCode(QOpenGLShader::Vertex, s_textVs)
+            || !m_textShader.addShaderFromSourceCode(QOpenGLShader::Fragment, s_textFs)
+            || !m_textShader.link()) {
+        qWarning() << m_textShader.log();
+    }
+    m_textLocPos = m_textShader.attributeLocation("pos");
+    m_textLocAnchor = m_textShader.attributeLocation("anchor");
+    m_textLocGlyph = m_textShader.attributeLocation("glyph");
+    m_textLocUv = m_textShader.attributeLocation("uv");
+    m_textLocLod = m_textShader.attributeLocation("lod");
 
     float vertices[12] = {0, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, 0};
     m_quadVertexBuffer.create();
@@ -105,88 +286,495 @@ void TreeMapWidget::initializeGL()
 
     m_nodeInstanceBuffer.create();
     m_groupInstanceBuffer.create();
+    m_labelInstanceBuffer.create();
+    m_groupLabelBuffer.create();
+
+    m_sceneBlitter.create();
+
+#if !QT_CONFIG(opengles2)
+    // timer queries aren't available on all GL implementations
+    m_sceneTimer.reset(new QOpenGLTimerQuery());
+    if (!m_sceneTimer->create())
+        m_sceneTimer.reset();
+#endif
 }
 
-class Buffer
+void TreeMapWidget::updateNodeInstances(RenderList &list)
 {
-public:
-    Buffer(uint sz = 1 << 24) : m_reserved(sz), m_bytes(new quint8[sz]) {}
-    void clear() { m_size = 0; }
-    const void *data() const { return (const void*) m_bytes.data(); }
-    int size() const { return m_size; }
+    list.rebuild = false;
+    list.chunk.first = m_instanceCount;
+    list.chunk.minScales.clear();
+    list.nodes.clear();
+    list.labels.clear();
+    list.labelFirst = m_workerLabelCount;
+
+    const QVector<Node*> &laidOut = laidOutNodes();
+    const bool fontChanged = (m_glyphAtlas.font() != m_requestFont);
+    if (fontChanged)
+        m_glyphAtlas.setFont(m_requestFont);
+    bool rebuild = fontChanged
+            || (m_instancesGeneration != layoutGeneration())
+            || (m_instancesMaxDepth != maxDepth())
+            || (m_instancesMaxSize != maxSize())
+            || (m_instanceChunkCount >= MAX_INSTANCE_CHUNKS);
+    if (!rebuild && m_instancesLaidOutNodes == laidOut.size())
+        return;
+
+    // the children of a node are rendered as soon as the node itself is large
+    // enough, and stay visible, because their own children are drawn on top
+    const auto collect = [&](int firstLaidOut, bool withRoot) {
+        m_nodeStaging->clear();
+        list.labels.clear();
+        m_stagingScales.clear();
+        m_stagingDepths.clear();
+        const auto add = [&](const Node &node, float minScale) {
+            m_nodeStaging->add(node.sceneRect, nodeColor(node));
+            m_stagingScales << minScale;
+            m_stagingDepths << node.depth;
+            addNodeLabel(list.labels, node, minScale);
+        };
+        if (withRoot)
+            add(*m_renderedNode, 0.0f);
+        for (int i = firstLaidOut; i < laidOut.size(); ++i) {
+            const Node &parent = *laidOut[i];
+            const float minScale = childMinScale(parent);
+            forEachLaidOutChild(parent, [&](const Node &child) {
+                if (maxDepth() <= 0 || child.depth - m_renderedNode->depth <= maxDepth())
+                    add(child, minScale);
+            });
+        }
+    };
 
-    void reserve(uint sz) {
-        resize(m_size + sz);
-        m_available += sz;
+    collect(rebuild ? 0 : m_instancesLaidOutNodes, rebuild);
+    const bool overflow = (m_instanceCount + m_stagingScales.size() > m_instanceCapacity)
+            || (m_workerLabelCount + list.labels.glyphs() > m_labelCapacity);
+    if (!rebuild && overflow) {
+        rebuild = true;
+        collect(0, true);
     }
+    const int count = m_stagingScales.size();
 
-    Buffer &operator<<(quint8 v) { write(v); return *this; }
-    Buffer &operator<<(float v) { write(v); return *this; }
-    Buffer &operator<<(const QColor &color) {
-        write<quint8>(color.red());
-        write<quint8>(color.green());
-        write<quint8>(color.blue());
-        write<quint8>(color.alpha());
-        return *this;
+    // within a chunk, parents still need to come before their children
+    m_stagingOrder.resize(count);
+    std::iota(m_stagingOrder.begin(), m_stagingOrder.end(), 0);
+    std::sort(m_stagingOrder.begin(), m_stagingOrder.end(), [&](int a, int b) {
+        const float sa = m_stagingScales[a];
+        const float sb = m_stagingScales[b];
+        return (sa < sb) || (sa == sb && m_stagingDepths[a] < m_stagingDepths[b]);
+    });
+
+    if (rebuild) {
+        m_instanceCount = 0;
+        m_instanceChunkCount = 0;
+        m_instanceCapacity = qMax(2 * count, MIN_INSTANCE_CAPACITY);
+        m_workerLabelCount = 0;
+        m_labelCapacity = qMax(2 * list.labels.glyphs(), MIN_INSTANCE_CAPACITY);
     }
+    list.rebuild = rebuild;
+    list.instanceCapacity = m_instanceCapacity;
+    list.labelCapacity = m_labelCapacity;
 
-private:
-    void resize(uint n) {
-        if (n < m_reserved)
-            return;
+    // the chunk's scales are usually still shared with the GUI thread's copy
+    list.chunk.first = m_instanceCount;
+    list.chunk.minScales.resize(count);
+    m_frameAllocatedBytes += count * sizeof(float);
+    for (int i = 0; i < count; ++i) {
+        list.chunk.minScales[i] = m_stagingScales[m_stagingOrder[i]];
+        list.nodes.add((*m_nodeStaging)[m_stagingOrder[i]]);
+    }
+    m_instanceCount += count;
+    if (count > 0)
+        ++m_instanceChunkCount;
 
-        uint newSize = m_reserved;
-        while (newSize <= n)
-            newSize *= 2;
+    // labels aren't sorted, each glyph is culled by the vertex shader instead
+    list.labelFirst = m_workerLabelCount;
+    m_workerLabelCount += list.labels.glyphs();
 
-        quint8 *newData = new quint8[newSize];
-        memcpy(newData, m_bytes.data(), m_size);
-        m_bytes.reset(newData);
-        m_reserved = newSize;
+    m_instancesGeneration = layoutGeneration();
+    m_instancesLaidOutNodes = laidOut.size();
+    m_instancesMaxDepth = maxDepth();
+    m_instancesMaxSize = maxSize();
+}
+
+void TreeMapWidget::addNodeLabel(LabelBuffer &labels, const Node &node, float minScale)
+{
+    const QString label = nodeLabel(node);
+    float fitScale, maxScale;
+    labelScaleRange(node, QSizeF(m_glyphAtlas.textWidth(label), m_glyphAtlas.lineHeight()), fitScale, maxScale);
+    labels.add(m_glyphAtlas, node.sceneRect.center(), label, qMax(minScale, fitScale), maxScale);
+}
+
+void TreeMapWidget::requestViewport(const QRectF &viewport)
+{
+    // input handling builds upon the target, which would otherwise drift out
+    // of the scene, while the layouter only ever shows the clamped viewport
+    m_targetViewport = clampedViewport(viewport);
+    m_hasPendingViewport = true;
+    update();
+}
+
+void TreeMapWidget::setSoftwareRendering(bool enabled)
+{
+    if (m_softwareRendering != enabled) {
+        m_softwareRendering = enabled;
+        requestRenderList();
     }
+}
 
-    template <class T> void write(T v) {
-        assert(m_size + sizeof(T) <= m_available);
-        void *dst = (void*) &m_bytes[m_size];
-        assert(((alignof (T) - 1) & (uintptr_t) dst) == 0);
-        *((T*) dst) = v;
-        m_size += sizeof(T);
+void TreeMapWidget::setFrameStatsVisible(bool visible)
+{
+    if (m_frameStatsVisible != visible) {
+        m_frameStatsVisible = visible;
+        update();
     }
+}
 
-    uint m_reserved = 0;
-    uint m_available = 0;
-    uint m_size = 0;
-    QScopedArrayPointer<quint8> m_bytes;
-};
+void TreeMapWidget::resetFrameStats(int windowSize)
+{
+    m_frameStats = FrameStats(windowSize);
+}
 
-class VertexBuffer : public Buffer
+bool TreeMapWidget::isRenderPending()
 {
-public:
-    VertexBuffer() : Buffer() {}
-    void add(const QRectF &rect, const QColor &bg, const QColor &fade)
-    {
-        const float x1 = rect.left();
-        const float y1 = rect.top();
-        const float w = rect.width();
-        const float h = rect.height();
+    if (m_hasPendingViewport || m_renderListRequested || !m_deferredActions.isEmpty())
+        return true;
 
-        reserve(stride());
-        *this << x1 << y1 << w << h << bg << fade;
+    QMutexLocker lock(&m_listMutex);
+    return m_workerBusy || m_listCompleted;
+}
+
+void TreeMapWidget::requestRenderList()
+{
+    m_renderListRequested = true;
+    update();
+}
+
+QPointF TreeMapWidget::targetViewToScene(const QPointF &pt) const
+{
+    return m_targetViewport.topLeft() + pt * (m_targetViewport.width() / m_oldSize.width());
+}
+
+void TreeMapWidget::startRenderWorker()
+{
+    runDeferredActions();
+
+    if (!m_hasPendingViewport && !m_renderListRequested && m_requestFont == font() && m_requestSoftware == m_softwareRendering)
+        return;
+
+    {
+        QMutexLocker lock(&m_listMutex);
+        if (m_workerBusy)
+            return;
+        m_workerBusy = true;
     }
 
-    void upload(QOpenGLBuffer &glBuffer)
+    m_requestViewport = m_targetViewport;
+    m_requestHasViewport = m_hasPendingViewport;
+    m_requestFont = font();
+    m_requestSoftware = m_softwareRendering;
+    m_requestImageSize = size() * devicePixelRatio();
+    m_requestScreenSize = m_oldSize;
+    m_hasPendingViewport = false;
+    m_renderListRequested = false;
+    m_renderWorker.start([this]() { runRenderWorker(); });
+}
+
+void TreeMapWidget::runRenderWorker()
+{
+    bool refine = false;
     {
-        glBuffer.bind();
-        glBuffer.allocate(data(), size());
+        QMutexLocker lock(&m_layoutMutex);
+        const int textMeasures = textMeasureCount();
+        QElapsedTimer timer;
+        timer.start();
+        if (m_requestHasViewport)
+            setViewport(m_requestViewport);
+        else
+            refineLayout();
+        const double cullMsecs = timer.nsecsElapsed() / 1e6;
+
+        buildRenderList(*m_workerList);
+        m_workerList->cullMsecs = cullMsecs;
+        m_workerList->textMeasures = textMeasureCount() - textMeasures;
+        refine = needsRefinement();
     }
 
-    int vertices() const { return size() / stride(); }
-    constexpr static int stride() { return 24; }
-};
+    // the list holds copies of everything the rasterizer needs, so hit tests
+    // and input handling don't have to wait for the scene to be rasterized
+    rasterizeRenderList(*m_workerList);
+
+    QMutexLocker lock(&m_listMutex);
+    m_workerList.swap(m_completedList);
+    m_listCompleted = true;
+    m_workerBusy = false;
+
+    // nodes that didn't fit into the time budget are laid out for one of the next frames
+    QMetaObject::invokeMethod(this, [this, refine]() {
+        if (refine)
+            m_renderListRequested = true;
+        runDeferredActions();
+        update();
+    }, Qt::QueuedConnection);
+}
+
+void TreeMapWidget::buildRenderList(RenderList &list)
+{
+    // all staging memory is re-used across frames, so this should stay at 0 most of the time
+    m_frameAllocatedBytes = 0;
+    const qsizetype stagingCapacity = m_stagingScales.capacity() + m_stagingDepths.capacity() + m_stagingOrder.capacity();
+
+    list.viewport = m_viewport;
+    list.lodScale = viewScale();
+
+    // switching between the backends re-sends all instances, as the other one doesn't have them
+    if (m_rasterizing != m_requestSoftware) {
+        m_rasterizing = m_requestSoftware;
+        m_instancesGeneration = -1;
+    }
+
+    for (int state = CulledViewport; state <= RenderChildren; ++state)
+        list.renderStateCounts[state] = renderStateCount((NodeRenderState) state);
+
+    // only newly laid out nodes need to be uploaded, panning and zooming just changes uniforms
+    QElapsedTimer timer;
+    timer.start();
+    updateNodeInstances(list);
+    list.instanceMsecs = timer.nsecsElapsed() / 1e6;
+
+    // group outlines and labels only depend on the current viewport
+    timer.restart();
+    list.groups.clear();
+    list.groupLabels.clear();
+    traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
+        if (!node.groupViewRect.isNull())
+            list.groups.add(node.groupViewRect, QColor(0, 0, 0, 0));
+        if (!node.groupLabelRect.isNull())
+            list.groupLabels.add(m_glyphAtlas, node.groupLabelRect.center(), nodeGroupLabel(node));
+        return node.responsibleForGroup;
+    });
+    list.groupMsecs = timer.nsecsElapsed() / 1e6;
+
+    // all glyphs have been rasterized by now, so the atlas is complete for this list
+    list.glyphAtlas = m_glyphAtlas.takeDirty() ? m_glyphAtlas.image() : QImage();
+
+    list.software = m_rasterizing;
+    list.rasterizeMsecs = 0.0;
+
+    const qsizetype stagingGrowth = m_stagingScales.capacity() + m_stagingDepths.capacity() + m_stagingOrder.capacity() - stagingCapacity;
+    m_frameAllocatedBytes += stagingGrowth * sizeof(int);
+    m_frameAllocatedBytes += m_nodeStaging->takeAllocatedBytes();
+    m_frameAllocatedBytes += list.nodes.takeAllocatedBytes();
+    m_frameAllocatedBytes += list.labels.takeAllocatedBytes();
+    m_frameAllocatedBytes += list.groups.takeAllocatedBytes();
+    m_frameAllocatedBytes += list.groupLabels.takeAllocatedBytes();
+    list.allocatedBytes = m_frameAllocatedBytes;
+}
+
+void TreeMapWidget::rasterizeRenderList(RenderList &list)
+{
+    if (!list.software)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+    if (list.rebuild)
+        m_rasterizer.clear();
+    if (list.rebuild || !list.glyphAtlas.isNull())
+        m_rasterizer.setGlyphAtlas(m_glyphAtlas.image());
+    m_rasterizer.addNodes(list.nodes.instances(), list.chunk.minScales.constData(), list.chunk.minScales.size());
+    m_rasterizer.addLabels(list.labels.instances(), list.labels.glyphs());
+
+    TreeMapRasterizer::Frame frame;
+    frame.screenSize = m_requestScreenSize;
+    frame.viewport = list.viewport;
+    frame.lodScale = list.lodScale;
+    frame.groups = list.groups.instances();
+    frame.groupCount = list.groups.vertices();
+    frame.groupLabels = list.groupLabels.instances();
+    frame.groupLabelCount = list.groupLabels.glyphs();
+
+    if (list.image.size() != m_requestImageSize) {
+        list.image = QImage(m_requestImageSize, QImage::Format_RGB32);
+        list.allocatedBytes += list.image.sizeInBytes();
+    }
+    m_rasterizer.render(list.image, frame);
+    list.rasterizeMsecs = timer.nsecsElapsed() / 1e6;
+}
+
+qint64 TreeMapWidget::uploadRenderList(RenderList &list)
+{
+    qint64 bytes = 0;
+    if (!list.glyphAtlas.isNull()) {
+        bytes += list.glyphAtlas.sizeInBytes();
+        m_glyphTexture.reset(new QOpenGLTexture(list.glyphAtlas, QOpenGLTexture::DontGenerateMipMaps));
+        m_glyphTexture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        m_glyphTexture->setWrapMode(QOpenGLTexture::ClampToEdge);
+    }
+
+    // software lists come with the finished image, and skip the GL instances
+    if (list.software) {
+        m_softwareTexture.reset(new QOpenGLTexture(list.image, QOpenGLTexture::DontGenerateMipMaps));
+        m_softwareTexture->setMinMagFilters(QOpenGLTexture::Nearest, QOpenGLTexture::Nearest);
+        return bytes + list.image.sizeInBytes();
+    }
+
+    if (list.rebuild) {
+        m_instanceChunks.clear();
+        m_nodeInstanceBuffer.bind();
+        m_nodeInstanceBuffer.allocate(list.instanceCapacity * sizeof(NodeInstance));
+        m_labelInstanceBuffer.bind();
+        m_labelInstanceBuffer.allocate(list.labelCapacity * LabelBuffer::stride());
+    }
+
+    if (!list.chunk.minScales.isEmpty()) {
+        m_nodeInstanceBuffer.bind();
+        m_nodeInstanceBuffer.write(list.chunk.first * sizeof(NodeInstance), list.nodes.data(), list.nodes.size());
+        m_nodeInstanceBuffer.release();
+        m_instanceChunks << list.chunk;
+    }
+
+    if (list.labels.size() > 0) {
+        m_labelInstanceBuffer.bind();
+        m_labelInstanceBuffer.write(list.labelFirst * LabelBuffer::stride(), list.labels.data(), list.labels.size());
+        m_labelInstanceBuffer.release();
+    }
+    m_labelCount = list.labelFirst + list.labels.glyphs();
+
+    list.groups.upload(m_groupInstanceBuffer, m_groupInstanceCapacity);
+    list.groupLabels.upload(m_groupLabelBuffer, m_groupLabelCapacity);
+
+    return bytes + list.nodes.size() + list.labels.size() + list.groups.size() + list.groupLabels.size();
+}
+
+void TreeMapWidget::addRenderListStats(const RenderList &list)
+{
+    m_frameStats.add(FrameStats::CullTime, list.cullMsecs);
+    m_frameStats.add(FrameStats::InstanceTime, list.instanceMsecs);
+    m_frameStats.add(FrameStats::GroupTime, list.groupMsecs);
+    if (list.software)
+        m_frameStats.add(FrameStats::RasterizeTime, list.rasterizeMsecs);
+    m_frameStats.add(FrameStats::AllocatedBytes, list.allocatedBytes);
+    m_frameStats.add(FrameStats::CulledViewportNodes, list.renderStateCounts[CulledViewport]);
+    m_frameStats.add(FrameStats::CulledDepthNodes, list.renderStateCounts[CulledDepth]);
+    m_frameStats.add(FrameStats::RenderNodes, list.renderStateCounts[Render]);
+    m_frameStats.add(FrameStats::RenderChildrenNodes, list.renderStateCounts[RenderChildren]);
+    m_frameStats.add(FrameStats::TextMeasures, list.textMeasures);
+}
+
+void TreeMapWidget::drawFrameStats(QPainter &painter)
+{
+    const QStringList lines = m_frameStats.summary();
+    const QFont font = QFontDatabase::systemFont(QFontDatabase::FixedFont);
+    const QFontMetrics metrics(font);
+
+    int width = 0;
+    for (const QString &line : lines)
+        width = qMax(width, metrics.horizontalAdvance(line));
+    const QRect rect(0, 0, width + 10, lines.size() * metrics.lineSpacing() + 10);
+
+    painter.fillRect(rect, QColor(0, 0, 0, 180));
+    painter.setFont(font);
+    painter.setPen(QColor(255, 255, 255));
+    for (int i = 0; i < lines.size(); ++i)
+        painter.drawText(5, 5 + i * metrics.lineSpacing() + metrics.ascent(), lines[i]);
+}
 
 void TreeMapWidget::paintGL()
 {
-    QOpenGLContext *gl = QOpenGLContext::currentContext();
+    QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+    QElapsedTimer frameTimer;
+    frameTimer.start();
+    QElapsedTimer timer;
+
+    // pick up the latest list, if the worker completed one since the last frame
+    bool newList = false;
+    {
+        QMutexLocker lock(&m_listMutex);
+        if (m_listCompleted) {
+            m_completedList.swap(m_drawList);
+            m_listCompleted = false;
+            newList = true;
+        }
+    }
+    if (newList) {
+        timer.start();
+        const qint64 uploadedBytes = uploadRenderList(*m_drawList);
+        m_frameStats.add(FrameStats::UploadTime, timer.nsecsElapsed() / 1e6);
+        m_frameStats.add(FrameStats::UploadedBytes, uploadedBytes);
+        addRenderListStats(*m_drawList);
+        m_sceneDirty = true;
+    }
+
+#if !QT_CONFIG(opengles2)
+    // the previous scene's timing is only read once it's available, so this never stalls
+    if (m_sceneTimerPending && m_sceneTimer->isResultAvailable()) {
+        m_frameStats.add(FrameStats::GpuTime, m_sceneTimer->waitForResult() / 1e6);
+        m_sceneTimerPending = false;
+    }
+#endif
+    m_bytesAllocatedLastFrame = newList ? m_drawList->allocatedBytes : 0;
+
+    // the worker isn't running at this point, unless it's still busy with a list from an earlier frame
+    if (m_layoutMutex.tryLock()) {
+        const bool selected = m_selectedNode && isRendered(*m_selectedNode);
+        const bool hovered = m_hoveredNode && m_hoveredNode != m_selectedNode && isRendered(*m_hoveredNode);
+        m_selectedOutline = selected ? m_selectedNode->viewRect : QRectF();
+        m_hoveredOutline = hovered ? m_hoveredNode->viewRect : QRectF();
+        m_layoutMutex.unlock();
+    }
+
+    // hand all viewport changes since the last frame over to the worker at once
+    startRenderWorker();
+
+    const QSize fboSize = size() * devicePixelRatio();
+    GLuint sceneTexture = 0;
+    QOpenGLTextureBlitter::Origin sceneOrigin = QOpenGLTextureBlitter::OriginBottomLeft;
+    if (m_drawList->software) {
+        // the render worker has already rasterized the whole scene
+        if (m_softwareTexture) {
+            sceneTexture = m_softwareTexture->textureId();
+            sceneOrigin = QOpenGLTextureBlitter::OriginTopLeft;
+        }
+    } else {
+        if (!m_sceneFbo || m_sceneFbo->size() != fboSize) {
+            m_sceneFbo.reset(new QOpenGLFramebufferObject(fboSize));
+            m_sceneDirty = true;
+        }
+
+        if (m_sceneDirty) {
+            m_sceneFbo->bind();
+            f->glViewport(0, 0, fboSize.width(), fboSize.height());
+            f->glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            f->glClear(GL_COLOR_BUFFER_BIT);
+            if (m_glyphTexture) {
+                timer.start();
+#if !QT_CONFIG(opengles2)
+                const bool timed = m_sceneTimer && !m_sceneTimerPending;
+                if (timed)
+                    m_sceneTimer->begin();
+#endif
+                renderScene();
+#if !QT_CONFIG(opengles2)
+                if (timed) {
+                    m_sceneTimer->end();
+                    m_sceneTimerPending = true;
+                }
+#endif
+                m_frameStats.add(FrameStats::SceneTime, timer.nsecsElapsed() / 1e6);
+            }
+            f->glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+            m_sceneDirty = false;
+        }
+        sceneTexture = m_sceneFbo->texture();
+    }
+
+    f->glViewport(0, 0, fboSize.width(), fboSize.height());
+    f->glDisable(GL_BLEND);
+    if (sceneTexture) {
+        m_sceneBlitter.bind();
+        m_sceneBlitter.blit(sceneTexture, QMatrix4x4(), sceneOrigin);
+        m_sceneBlitter.release();
+    }
 
     // while resizing, we refrain from updating the layout, but just scale the content
     // for a short amount of time
@@ -196,40 +784,55 @@ void TreeMapWidget::paintGL()
         return QRectF(r.x() * scaleX, r.y() * scaleY, r.width() * scaleX, r.height() * scaleY);
     };
 
-    // if the node layout has changed, we need to re-build the vertex buffer
-    if (m_nodeInstanceBufferDirty) {
-        VertexBuffer vertices;
-        traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
-            if (node.renderState == Render)
-                vertices.add(node.sceneRect, node.color, QColor(0, 0, 0));
-            return (node.renderState == RenderChildren);
-        });
-        vertices.upload(m_nodeInstanceBuffer);
-        m_nodeInstancesCount = vertices.vertices();
-        m_nodeInstanceBufferDirty = false;
+    // Render selected/highlighted outlines
+    timer.start();
+    QPainter painter(this);
+    const QColor paintColor(0, 0, 0);
+    painter.setBrush(Qt::NoBrush);
+    if (!m_selectedOutline.isNull()) {
+        painter.setPen(QPen(paintColor, 3.0f));
+        painter.drawRect(scale(m_selectedOutline.adjusted(0, 0, -1.5f, -1.5f)));
+    }
+    if (!m_hoveredOutline.isNull()) {
+        painter.setPen(QPen(paintColor, 2.0f));
+        painter.drawRect(scale(m_hoveredOutline.adjusted(0, 0, 1.0f, 1.0f)));
     }
+    if (m_frameStatsVisible)
+        drawFrameStats(painter);
+    painter.end();
+
+    m_frameStats.add(FrameStats::OverlayTime, timer.nsecsElapsed() / 1e6);
+    m_frameStats.add(FrameStats::FrameTime, frameTimer.nsecsElapsed() / 1e6);
+}
+
+void TreeMapWidget::renderScene()
+{
+    QOpenGLContext *gl = QOpenGLContext::currentContext();
+    const RenderList &list = *m_drawList;
 
-    const auto render = [&](QOpenGLBuffer &instanceBuffer, int instances, QPointF ofs, float scale, float border) {
+    const auto render = [&](QOpenGLBuffer &instanceBuffer, int first, int instances, QPointF ofs, float scale, float border) {
         m_shader.bind();
         m_shader.setUniformValue("screenSize", QVector2D(m_oldSize.width(), m_oldSize.height()));
         m_shader.setUniformValue("border", border);
         m_shader.setUniformValue("offset", ofs);
         m_shader.setUniformValue("scale", scale);
+        m_shader.setUniformValue("fadeColor", QColor(0, 0, 0));
 
         m_quadVertexBuffer.bind();
         m_shader.enableAttributeArray(m_shaderLocPos);
         m_shader.setAttributeBuffer(m_shaderLocPos, GL_FLOAT, 0, 2, 8);
 
+        const int offset = first * sizeof(NodeInstance);
         instanceBuffer.bind();
-        m_shader.enableAttributeArray(m_shaderLocRect);
+        m_shader.enableAttributeArray(m_shaderLocRectPos);
+        m_shader.enableAttributeArray(m_shaderLocRectSize);
         m_shader.enableAttributeArray(m_shaderLocBgColor);
-        m_shader.enableAttributeArray(m_shaderLocFadeColor);
-        m_shader.setAttributeBuffer(m_shaderLocRect, GL_FLOAT, 0, 4, VertexBuffer::stride());
-        m_shader.setAttributeBuffer(m_shaderLocBgColor, GL_UNSIGNED_BYTE, 16, 4, VertexBuffer::stride());
-        m_shader.setAttributeBuffer(m_shaderLocFadeColor, GL_UNSIGNED_BYTE, 20, 4, VertexBuffer::stride());
-        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocRect, 1);
+        m_shader.setAttributeBuffer(m_shaderLocRectPos, GL_FLOAT, offset, 2, sizeof(NodeInstance));
+        m_shader.setAttributeBuffer(m_shaderLocRectSize, GL_FLOAT, offset + 8, 2, sizeof(NodeInstance));
+        m_shader.setAttributeBuffer(m_shaderLocBgColor, GL_UNSIGNED_BYTE, offset + 16, 4, sizeof(NodeInstance));
+        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocRectPos, 1);
+        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocRectSize, 1);
         gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocBgColor, 1);
-        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocFadeColor, 1);
 
         gl->extraFunctions()->glDisable(GL_CULL_FACE);
         gl->extraFunctions()->glEnable(GL_BLEND);
@@ -238,68 +841,85 @@ void TreeMapWidget::paintGL()
         gl->extraFunctions()->glDrawArraysInstanced(GL_TRIANGLES, 0, 6, instances);
 
         m_shader.disableAttributeArray(m_shaderLocPos);
-        m_shader.disableAttributeArray(m_shaderLocRect);
+        m_shader.disableAttributeArray(m_shaderLocRectPos);
+        m_shader.disableAttributeArray(m_shaderLocRectSize);
         m_shader.disableAttributeArray(m_shaderLocBgColor);
-        m_shader.disableAttributeArray(m_shaderLocFadeColor);
-        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocRect, 0);
+        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocRectPos, 0);
+        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocRectSize, 0);
         gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocBgColor, 0);
-        gl->extraFunctions()->glVertexAttribDivisor(m_shaderLocFadeColor, 0);
 
         instanceBuffer.release();
         m_shader.release();
     };
 
-    // Render all nodes
-    render(m_nodeInstanceBuffer, m_nodeInstancesCount, -m_viewport.topLeft(), m_oldSize.width() / m_viewport.width(), 0.3f);
+    const auto renderText = [&](QOpenGLBuffer &instanceBuffer, int glyphs, QPointF ofs, float scale, float lodScale, const QColor &color) {
+        if (glyphs <= 0)
+            return;
 
-    // Render selected/highlighted outlines and node labels
-    QPainter painter(this);
-    const QColor paintColor(0, 0, 0);
-    painter.setBrush(Qt::NoBrush);
-    traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
-        if (node.renderState == Render) {
-            // draw rect
-            if (m_selectedNode == &node) {
-                painter.setPen(QPen(paintColor, 3.0f));
-                painter.drawRect(scale(node.viewRect.adjusted(0, 0, -1.5f, -1.5f)));
-            }
-            else if (m_hoveredNode == &node) {
-                painter.setPen(QPen(paintColor, 2.0f));
-                painter.drawRect(scale(node.viewRect.adjusted(0, 0, 1.0f, 1.0f)));
-            }
+        QOpenGLExtraFunctions *f = gl->extraFunctions();
+        m_textShader.bind();
+        m_textShader.setUniformValue("screenSize", QVector2D(m_oldSize.width(), m_oldSize.height()));
+        m_textShader.setUniformValue("offset", ofs);
+        m_textShader.setUniformValue("scale", scale);
+        m_textShader.setUniformValue("lodScale", lodScale);
+        m_textShader.setUniformValue("atlasSize", QVector2D(m_glyphTexture->width(), m_glyphTexture->height()));
+        m_textShader.setUniformValue("textColor", color);
+        m_textShader.setUniformValue("atlas", 0);
+        m_glyphTexture->bind(0);
 
-            // possibly draw label text, if there is enough space
-            if (node.viewRect.width() > 10 && node.viewRect.height() > 5) {
-                painter.setPen(paintColor);
-                const QRectF bounds = painter.boundingRect(node.viewRect, Qt::AlignHCenter | Qt::AlignCenter, node.label);
-                if (bounds.width() < node.viewRect.width() + 10 && bounds.height() < node.viewRect.height() + 5) {
-                    painter.drawText(scale(node.viewRect), Qt::AlignHCenter | Qt::AlignCenter, node.label);
-                }
-            }
-        }
-        return (node.renderState == RenderChildren);
-    });
+        m_quadVertexBuffer.bind();
+        m_textShader.enableAttributeArray(m_textLocPos);
+        m_textShader.setAttributeBuffer(m_textLocPos, GL_FLOAT, 0, 2, 8);
 
-    // render group node outlines (blended on top)
-    painter.beginNativePainting();
-    VertexBuffer groupVertices;
-    traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
-        if (!node.groupViewRect.isNull()) {
-            groupVertices.add(node.groupViewRect, QColor(0, 0, 0, 0), QColor(0, 0, 0));
-        }
-        return node.responsibleForGroup;
-    });
-    groupVertices.upload(m_groupInstanceBuffer);
-    render(m_groupInstanceBuffer, groupVertices.vertices(), QPointF(0, 0), 1.0f, 0.6f);
-    painter.endNativePainting();
+        // glyph offsets and atlas positions are in pixels, so they mustn't be normalized
+        const int stride = LabelBuffer::stride();
+        instanceBuffer.bind();
+        m_textShader.enableAttributeArray(m_textLocAnchor);
+        m_textShader.enableAttributeArray(m_textLocGlyph);
+        m_textShader.enableAttributeArray(m_textLocUv);
+        m_textShader.enableAttributeArray(m_textLocLod);
+        f->glVertexAttribPointer(m_textLocAnchor, 2, GL_FLOAT, GL_FALSE, stride, (const void*) 0);
+        f->glVertexAttribPointer(m_textLocGlyph, 4, GL_SHORT, GL_FALSE, stride, (const void*) 8);
+        f->glVertexAttribPointer(m_textLocUv, 2, GL_UNSIGNED_SHORT, GL_FALSE, stride, (const void*) 16);
+        f->glVertexAttribPointer(m_textLocLod, 2, GL_FLOAT, GL_FALSE, stride, (const void*) 20);
+        f->glVertexAttribDivisor(m_textLocAnchor, 1);
+        f->glVertexAttribDivisor(m_textLocGlyph, 1);
+        f->glVertexAttribDivisor(m_textLocUv, 1);
+        f->glVertexAttribDivisor(m_textLocLod, 1);
 
-    // render group node labels
-    painter.setPen(QPen(QColor(255, 255, 255), 1.0f));
-    traverseRenderNodes(*m_renderedNode, [&](const Node &node) {
-        if (!node.groupLabelRect.isNull())
-            painter.drawText(scale(node.groupLabelRect), Qt::AlignCenter | Qt::AlignVCenter, node.groupLabel);
-        return node.responsibleForGroup;
-    });
+        f->glEnable(GL_BLEND);
+        f->glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        f->glDrawArraysInstanced(GL_TRIANGLES, 0, 6, glyphs);
+
+        m_textShader.disableAttributeArray(m_textLocPos);
+        m_textShader.disableAttributeArray(m_textLocAnchor);
+        m_textShader.disableAttributeArray(m_textLocGlyph);
+        m_textShader.disableAttributeArray(m_textLocUv);
+        m_textShader.disableAttributeArray(m_textLocLod);
+        f->glVertexAttribDivisor(m_textLocAnchor, 0);
+        f->glVertexAttribDivisor(m_textLocGlyph, 0);
+        f->glVertexAttribDivisor(m_textLocUv, 0);
+        f->glVertexAttribDivisor(m_textLocLod, 0);
+
+        instanceBuffer.release();
+        m_glyphTexture->release();
+        m_textShader.release();
+    };
+
+    // Render all nodes, the current zoom level decides how much of each chunk is visible
+    const float lodScale = list.lodScale;
+    const float sceneScale = m_oldSize.width() / list.viewport.width();
+    for (const InstanceChunk &chunk : m_instanceChunks) {
+        const int count = std::upper_bound(chunk.minScales.cbegin(), chunk.minScales.cend(), lodScale) - chunk.minScales.cbegin();
+        render(m_nodeInstanceBuffer, chunk.first, count, -list.viewport.topLeft(), sceneScale, 0.3f);
+    }
+
+    // Render all node labels in one call, the shader drops those outside of their zoom range
+    renderText(m_labelInstanceBuffer, m_labelCount, -list.viewport.topLeft(), sceneScale, lodScale, QColor(0, 0, 0));
+
+    // render group node outlines and labels (blended on top)
+    render(m_groupInstanceBuffer, 0, list.groups.vertices(), QPointF(0, 0), 1.0f, 0.6f);
+    renderText(m_groupLabelBuffer, list.groupLabels.glyphs(), QPointF(0, 0), 1.0f, 1.0f, QColor(255, 255, 255));
 }
 
 void TreeMapWidget::wheelEvent(QWheelEvent *event)
@@ -307,14 +927,14 @@ void TreeMapWidget::wheelEvent(QWheelEvent *event)
     const float relx = (float) event->position().x() / (float) width();
     const float rely = (float) event->position().y() / (float) height();
 
-    const float cx = m_viewport.left() + m_viewport.width() * relx;
-    const float cy = m_viewport.top() + m_viewport.height() * rely;
+    const float cx = m_targetViewport.left() + m_targetViewport.width() * relx;
+    const float cy = m_targetViewport.top() + m_targetViewport.height() * rely;
 
     const float delta = qPow(0.5f, event->angleDelta().y() / 1000.f);
-    const float nw = m_viewport.width() * delta;
-    const float nh = m_viewport.height() * delta;
+    const float nw = m_targetViewport.width() * delta;
+    const float nh = m_targetViewport.height() * delta;
 
-    setViewport(QRectF(cx - relx * nw, cy - rely * nh, nw, nh));
+    requestViewport(QRectF(cx - relx * nw, cy - rely * nh, nw, nh));
 }
 
 void TreeMapWidget::keyPressEvent(QKeyEvent *event)
@@ -336,26 +956,31 @@ void TreeMapWidget::mousePressEvent(QMouseEvent *event)
     if (event->buttons() == Qt::LeftButton) {
         m_mouseDown = true;
         m_isPanning = false;
-        m_mouseDownViewport = m_viewport;
+        m_mouseDownViewport = m_targetViewport;
         m_mouseDownViewPos = event->pos();
-        m_mouseDownModelPos = viewToScene(event->pos());
+        m_mouseDownModelPos = targetViewToScene(event->pos());
     }
 
     if (event->buttons() == Qt::RightButton) {
-        setSelectedNode(getNodeAt(event->pos(), m_renderedNode), event->pos());
+        const QPoint pos = event->pos();
+        hitTest(pos, [this, pos](const NodeHit &hit) {
+            setSelectedNode(hit, pos);
 
-        if (m_selectedNode) {
-            emit nodeRightClicked(m_selectedNode->userData, mapToGlobal(event->pos()));
-        }
+            if (hit.node) {
+                emit nodeRightClicked(hit.userData, mapToGlobal(pos));
+            }
+        });
     }
 }
 
 void TreeMapWidget::mouseDoubleClickEvent(QMouseEvent *event)
 {
     if (event->button() == Qt::LeftButton) {
-        if (const Node *node = getNodeAt(event->pos(), m_renderedNode)) {
-            zoomIn(node->userData);
-        }
+        hitTest(event->pos(), [this](const NodeHit &hit) {
+            if (hit.node) {
+                zoomIn(hit.userData);
+            }
+        });
     }
 }
 
@@ -372,12 +997,16 @@ void TreeMapWidget::mouseMoveEvent(QMouseEvent *event)
             m_isPanning = true;
         }
 
-        QPointF mouseAt = viewToScene(event->pos());
+        QPointF mouseAt = targetViewToScene(event->pos());
         QPointF delta = m_mouseDownModelPos - mouseAt;
-        setViewport(m_viewport.translated(delta));
+        requestViewport(m_targetViewport.translated(delta));
     }
-    else {
-        setHoveredNode(getNodeAt(event->pos(), m_renderedNode), event->pos());
+    else if (m_layoutMutex.tryLock()) {
+        // hovering isn't worth waiting for the render worker, the next move event will catch up
+        const NodeHit hit = resolveHit(getNodeAt(event->pos(), m_renderedNode));
+        m_frameStats.add(FrameStats::HitTestNodes, hitTestNodeCount());
+        m_layoutMutex.unlock();
+        setHoveredNode(hit, event->pos());
     }
 }
 
@@ -385,49 +1014,77 @@ void TreeMapWidget::mouseReleaseEvent(QMouseEvent *event)
 {
     // if we pressed left btn, but only barely moved the mouse, we count this as a click
     if (m_mouseDown && !m_isPanning) {
-        setSelectedNode(getNodeAt(event->pos(), m_renderedNode), event->pos());
+        const QPoint pos = event->pos();
+        hitTest(pos, [this, pos](const NodeHit &hit) { setSelectedNode(hit, pos); });
     }
     m_mouseDown = false;
 }
 
-QRectF TreeMapWidget::getTextBounds(const QString &text) const
-{
-    return QFontMetrics(font()).boundingRect(text);
-}
-
 void TreeMapWidget::onNodeTreeChanged()
 {
-    setHoveredNode(nullptr, QPoint());
-    setSelectedNode(nullptr, QPoint());
-    update();
+    setHoveredNode(NodeHit(), QPoint());
+    setSelectedNode(NodeHit(), QPoint());
 }
 
 void TreeMapWidget::onLayoutChanged()
 {
-    m_nodeInstanceBufferDirty = true;
-    update();
+    // layouts are reset from the GUI thread only, and pending viewports refer to the old one
+    m_hasPendingViewport = false;
+    m_targetViewport = m_viewport;
+    requestRenderList();
 }
 
 void TreeMapWidget::onViewportChanged()
 {
-    m_nodeInstanceBufferDirty = true;
-    update();
+    // the render worker applies viewports itself, and hands over the result when done
+    if (QThread::currentThread() != thread())
+        return;
+
+    if (!m_hasPendingViewport)
+        m_targetViewport = m_viewport;
+    requestRenderList();
 }
 
-void TreeMapWidget::setSelectedNode(const Node *node, QPoint mouse)
+void TreeMapWidget::hitTest(QPoint pt, const std::function<void(const NodeHit &)> &done)
 {
-    if (m_selectedNode != node) {
-        m_selectedNode = node;
+    QSharedPointer<NodeHit> hit(new NodeHit);
+    withLayout([this, pt, hit]() { *hit = resolveHit(getNodeAt(pt, m_renderedNode)); },
+               [hit, done]() { done(*hit); });
+}
+
+TreeMapWidget::NodeHit TreeMapWidget::resolveHit(const Node *node) const
+{
+    NodeHit hit;
+    if (node) {
+        hit.node = node;
+        hit.userData = nodeUserData(*node);
+
+        // buckets don't correspond to a single item, so summarize their contents
+        if (isBucket(*node))
+            hit.bucketSummary = QString("%1 small items, %2 LOC").arg(node->bucketCount).arg(qRound(node->bucketSize));
+    }
+    return hit;
+}
+
+void TreeMapWidget::setSelectedNode(const NodeHit &hit, QPoint mouse)
+{
+    if (m_selectedNode != hit.node) {
+        m_selectedNode = hit.node;
         update();
     }
-    emit nodeSelected(node ? node->userData : nullptr, mouse);
+    emit nodeSelected(hit.userData, mouse);
 }
 
-void TreeMapWidget::setHoveredNode(const Node *node, QPoint mouse)
+void TreeMapWidget::setHoveredNode(const NodeHit &hit, QPoint mouse)
 {
-    if (m_hoveredNode != node) {
-        m_hoveredNode = node;
+    if (m_hoveredNode != hit.node) {
+        m_hoveredNode = hit.node;
         update();
+
+        if (!hit.bucketSummary.isEmpty())
+            QToolTip::showText(mapToGlobal(mouse), hit.bucketSummary, this);
+        else
+            QToolTip::hideText();
     }
-    emit nodeHovered(node ? node->userData : nullptr, mouse);
+    emit nodeHovered(hit.userData, mouse);
 }
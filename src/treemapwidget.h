@@ -3,10 +3,28 @@
 #include <QOpenGLWidget>
 #include <QOpenGLShaderProgram>
 #include <QOpenGLBuffer>
+#include <QOpenGLTexture>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLTextureBlitter>
+#if !QT_CONFIG(opengles2)
+#include <QOpenGLTimerQuery>
+#endif
 #include <QTimer>
+#include <QScopedPointer>
+#include <QMutex>
+#include <QThreadPool>
+
+#include <functional>
 
 #include "squarify.h"
 #include "treemaplayouter.h"
+#include "glyphatlas.h"
+#include "treemaprasterizer.h"
+#include "framestats.h"
+
+class QPainter;
+class VertexBuffer;
+class LabelBuffer;
 
 class TreeMapWidget : public QOpenGLWidget, public TreeMapLayouter
 {
@@ -18,10 +36,52 @@ public:
     TreeMapWidget(QWidget *parent = nullptr);
     ~TreeMapWidget();
 
+    /**
+     * Renders the scene on the CPU instead, and only uses GL to show the
+     * resulting image. Enabled by default if LOCVIEW_SOFTWARE_RENDERING is set.
+     */
+    bool softwareRendering() const { return m_softwareRendering; }
+    void setSoftwareRendering(bool enabled);
+
+    /** Heap memory allocated for instance data while building the last frame's render list */
+    qint64 bytesAllocatedLastFrame() const { return m_bytesAllocatedLastFrame; }
+
+    /**
+     * Timings and counters of the last frames. The overlay shows them in the
+     * top left corner, and is enabled by default if LOCVIEW_FRAME_STATS is set.
+     */
+    const FrameStats &frameStats() const { return m_frameStats; }
+    bool frameStatsVisible() const { return m_frameStatsVisible; }
+    void setFrameStatsVisible(bool visible);
+    void resetFrameStats(int windowSize);
+
+    /**
+     * Whether input or layout changes still wait for their render list to be
+     * built and drawn, or for the resize delay to pass. Used to replay
+     * recorded sessions as fast as the widget can follow.
+     */
+    bool isRenderPending();
+    bool isResizePending() const { return m_resizeTimer.isActive(); }
+    void waitForRenderWorker() { m_renderWorker.waitForDone(); }
+
+    /**
+     * The layouter's state is shared with the render worker. If it is busy,
+     * these are deferred until it is done, instead of blocking the GUI thread.
+     */
+    void setNodeTree(const QSharedPointer<NodeTree> &tree);
+    void setMaxDepth(int maxDepth);
+    void setMaxSize(int maxSize);
+    void setMinGroupSize(int minGroupSize);
+    void zoomIn(void *userData);
+    void zoomOut();
+    void zoomTo(void *userData);
+
 signals:
     void nodeSelected(void *userData, QPoint mouse);
     void nodeHovered(void *userData, QPoint mouse);
     void nodeRightClicked(void *userData, QPoint mouse);
+    /** Emitted once deferred setters are applied, which may have clamped their values */
+    void settingsChanged();
 
 protected:
     void resizeEvent(QResizeEvent *event) override;
@@ -36,7 +96,6 @@ protected:
     void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
 
-    QRectF getTextBounds(const QString &text) const override;
     void onNodeTreeChanged() override;
     void onLayoutChanged() override;
     void onViewportChanged() override;
@@ -45,8 +104,93 @@ private slots:
     void onResize();
 
 private:
-    void setSelectedNode(const Node *node, QPoint mouse);
-    void setHoveredNode(const Node *node, QPoint mouse);
+    /**
+     * A hit node along with everything the GUI thread needs to know about it,
+     * which has to be resolved while holding the layout, as the render worker
+     * may re-use the node afterwards.
+     */
+    struct NodeHit
+    {
+        const Node *node = nullptr;
+        void *userData = nullptr;
+        QString bucketSummary; // only set for buckets
+    };
+    NodeHit resolveHit(const Node *node) const;
+
+    void setSelectedNode(const NodeHit &hit, QPoint mouse);
+    void setHoveredNode(const NodeHit &hit, QPoint mouse);
+
+    /** Hit-tests the current layout, deferred until the render worker releases it */
+    void hitTest(QPoint pt, const std::function<void(const NodeHit &)> &done);
+
+    /**
+     * Runs action while holding the layout, and done afterwards on the GUI
+     * thread. Both are queued while the render worker holds the layout, and
+     * run in order once the worker hands over its result.
+     */
+    void withLayout(const std::function<void()> &action, const std::function<void()> &done = {});
+    void runDeferredActions();
+    void onSettingsApplied();
+    struct DeferredAction
+    {
+        std::function<void()> action;
+        std::function<void()> done;
+    };
+    QVector<DeferredAction> m_deferredActions;
+
+    /**
+     * Input events only record the viewport they want to see. At most once
+     * per frame, paintGL() hands the latest one to the render worker, which
+     * applies it to the layouter and builds the next RenderList, while the
+     * GUI thread keeps on drawing the previous one. m_targetViewport is what
+     * input handling builds upon, even if it hasn't been applied yet.
+     */
+    void requestViewport(const QRectF &viewport);
+    void requestRenderList();
+    QPointF targetViewToScene(const QPointF &pt) const;
+    QRectF m_targetViewport;
+    bool m_hasPendingViewport = false;
+    bool m_renderListRequested = true;
+
+    struct RenderList;
+    void startRenderWorker();
+    void runRenderWorker();
+    void buildRenderList(RenderList &list);
+
+    /** Only works on the list and m_rasterizer, so the layout doesn't need to be held */
+    void rasterizeRenderList(RenderList &list);
+
+    /** Returns the number of bytes that were uploaded */
+    qint64 uploadRenderList(RenderList &list);
+
+    // guards the layouter state, and is held by the worker while it builds a list
+    QMutex m_layoutMutex;
+    QThreadPool m_renderWorker;
+
+    // written by the GUI thread before the worker is started
+    QRectF m_requestViewport;
+    bool m_requestHasViewport = false;
+    QFont m_requestFont;
+    bool m_requestSoftware = false;
+    QSize m_requestImageSize;
+    QSize m_requestScreenSize;
+
+    bool m_softwareRendering = false;
+    bool m_rasterizing = false; // whether the worker currently feeds m_rasterizer
+    TreeMapRasterizer m_rasterizer;
+    QScopedPointer<QOpenGLTexture> m_softwareTexture;
+
+    // hand-over of completed lists, guarded by m_listMutex
+    QMutex m_listMutex;
+    QScopedPointer<RenderList> m_workerList;
+    QScopedPointer<RenderList> m_completedList;
+    QScopedPointer<RenderList> m_drawList;
+    bool m_listCompleted = false;
+    bool m_workerBusy = false;
+
+    // outlines in view space, re-used while the worker holds the layout
+    QRectF m_selectedOutline;
+    QRectF m_hoveredOutline;
 
     // Keep track of where we clicked when panning
     bool m_mouseDown = false;
@@ -65,15 +209,90 @@ private:
 
     QOpenGLShaderProgram m_shader;
     int m_shaderLocPos;
-    int m_shaderLocRect;
+    int m_shaderLocRectPos;
+    int m_shaderLocRectSize;
     int m_shaderLocBgColor;
-    int m_shaderLocFadeColor;
 
     QOpenGLBuffer m_quadVertexBuffer;
 
+    /**
+     * Nodes, labels and groups are rendered into m_sceneFbo only when the
+     * layout or viewport changed. Every other frame just copies it to the
+     * screen, and draws the hovered and selected outlines on top.
+     */
+    void renderScene();
+    QScopedPointer<QOpenGLFramebufferObject> m_sceneFbo;
+    QOpenGLTextureBlitter m_sceneBlitter;
+    bool m_sceneDirty = true;
+
+    /**
+     * Instances of all laid out nodes in scene space, which are uploaded once
+     * per layout, and extended by another chunk whenever deeper levels are laid
+     * out. Each chunk is sorted by the zoom scale from which on its nodes are
+     * visible, so every zoom level draws a prefix of every chunk.
+     */
+    struct InstanceChunk
+    {
+        int first = 0;
+        QVector<float> minScales;
+    };
+    void updateNodeInstances(RenderList &list);
+
     QOpenGLBuffer m_nodeInstanceBuffer;
-    bool m_nodeInstanceBufferDirty = true;
-    int m_nodeInstancesCount = 0;
+    QVector<InstanceChunk> m_instanceChunks;
+
+    // bookkeeping of the render worker about what has been handed over so far
+    int m_instanceCount = 0;
+    int m_instanceCapacity = 0;
+    int m_instanceChunkCount = 0;
+    int m_instancesGeneration = -1;
+    int m_instancesLaidOutNodes = 0;
+    int m_instancesMaxDepth = 0;
+    int m_instancesMaxSize = 0;
 
     QOpenGLBuffer m_groupInstanceBuffer;
+    int m_groupInstanceCapacity = 0;
+
+    /**
+     * Labels are drawn as one textured quad per glyph. Node labels are built
+     * together with the node instances, and each glyph knows the zoom range in
+     * which its label is visible, so all of them are drawn in a single call.
+     * Group labels depend on the viewport, and are streamed every frame.
+     */
+    QOpenGLShaderProgram m_textShader;
+    int m_textLocPos;
+    int m_textLocAnchor;
+    int m_textLocGlyph;
+    int m_textLocUv;
+    int m_textLocLod;
+
+    GlyphAtlas m_glyphAtlas; // only used by the render worker
+    QScopedPointer<QOpenGLTexture> m_glyphTexture;
+    void addNodeLabel(LabelBuffer &labels, const Node &node, float minScale);
+
+    QOpenGLBuffer m_labelInstanceBuffer;
+    int m_labelCount = 0;
+    int m_workerLabelCount = 0;
+    int m_labelCapacity = 0;
+
+    QOpenGLBuffer m_groupLabelBuffer;
+    int m_groupLabelCapacity = 0;
+
+    // staging memory of the render worker, kept across frames
+    QScopedPointer<VertexBuffer> m_nodeStaging;
+    QVector<float> m_stagingScales;
+    QVector<int> m_stagingDepths;
+    QVector<int> m_stagingOrder;
+    qint64 m_frameAllocatedBytes = 0;
+    qint64 m_bytesAllocatedLastFrame = 0;
+
+    /** Worker timings arrive with their render list, GPU timings are read one frame late */
+    void addRenderListStats(const RenderList &list);
+    void drawFrameStats(QPainter &painter);
+    FrameStats m_frameStats;
+    bool m_frameStatsVisible = false;
+#if !QT_CONFIG(opengles2)
+    QScopedPointer<QOpenGLTimerQuery> m_sceneTimer;
+#endif
+    bool m_sceneTimerPending = false;
 };
@@ -1,5 +1,7 @@
 #include "util.h"
 
+#include <QStringList>
+
 QString formatNumDecimals(int num)
 {
     if (num < 1000)
@@ -8,3 +10,18 @@ QString formatNumDecimals(int num)
     QString remainder = QString::asprintf("%03d", num % 1000);
     return formatNumDecimals(num / 1000) + "." + remainder;
 }
+
+QSize parseSize(const QString &text)
+{
+    const QStringList parts = text.trimmed().split('x', Qt::KeepEmptyParts, Qt::CaseInsensitive);
+    if (parts.size() != 2)
+        return QSize();
+
+    bool okWidth, okHeight;
+    const int width = parts[0].trimmed().toInt(&okWidth);
+    const int height = parts[1].trimmed().toInt(&okHeight);
+    if (!okWidth || !okHeight || width <= 0 || height <= 0)
+        return QSize();
+
+    return QSize(width, height);
+}
@@ -1,5 +1,9 @@
 #pragma once
 
 #include <QString>
+#include <QSize>
 
 QString formatNumDecimals(int num);
+
+/** Parses sizes given as e.g. "30000x20000", returns an invalid size on errors */
+QSize parseSize(const QString &text);